@@ -0,0 +1,106 @@
+/*******************************************
+ *
+ *	cascadebench
+ *   Speedup of the parallel cascade evaluation of the
+ *   object detector over thread counts.
+ *
+ *   cascadebench <cascade> [iterations] [pattern]
+ *
+ *   pattern is that of SyntheticSource, "face" by default.
+ *   Objects are those found by the last run. Every thread
+ *   count has to find the same rectangles as one thread,
+ *   the benchmark fails otherwise.
+ *
+ ********************************************/
+
+#include <cv.h>
+
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <vector>
+
+#include "parallelcascade.h"
+#include "syntheticsource.h"
+
+using namespace cv;
+using namespace std;
+
+static bool rectLess(const Rect& a, const Rect& b) {
+    if (a.x != b.x)
+        return a.x < b.x;
+    if (a.y != b.y)
+        return a.y < b.y;
+    if (a.width != b.width)
+        return a.width < b.width;
+    return a.height < b.height;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: cascadebench <cascade> [iterations] [pattern]\n");
+        return 1;
+    }
+    const int sizes[][2] = {{320, 240}, {640, 480}, {1280, 720}};
+    const size_t threads[] = {1, 2, 3, 4, 6, 8};
+    const int iterations = argc > 2 ? atoi(argv[2]) : 20;
+    const char* pattern = argc > 3 ? argv[3] : "face";
+
+    try {
+        printf("%u cores\n", boost::thread::hardware_concurrency());
+        printf("%-10s %7s %10s %8s %10s %8s\n", "size", "threads", "time [ms]", "speedup", "efficiency", "objects");
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+            // Same preprocessing as the object detector
+            SyntheticSource source(sizes[i][0], sizes[i][1], 0, pattern);
+            Mat frame, gray, equalized;
+            if (!source.grab() || !source.retrieve(frame)) {
+                fprintf(stderr, "No synthetic frame of %dx%d\n", sizes[i][0], sizes[i][1]);
+                return 1;
+            }
+            cvtColor(frame, gray, CV_RGB2GRAY);
+            equalizeHist(gray, equalized);
+
+            double single = 0;
+            vector<Rect> reference;
+            for (size_t k = 0; k < sizeof(threads) / sizeof(threads[0]); ++k) {
+                ParallelCascade cascade;
+                cascade.setThreads(threads[k]);
+                if (!cascade.load(argv[1])) {
+                    fprintf(stderr, "Could not load cascade classifier %s\n", argv[1]);
+                    return 1;
+                }
+
+                vector<Rect> objects;
+                cascade.detectMultiScale(equalized, objects, 1.1, 2, Size(30, 30));
+                int64 start = getTickCount();
+                for (int n = 0; n < iterations; ++n)
+                    cascade.detectMultiScale(equalized, objects, 1.1, 2, Size(30, 30));
+                double time = (getTickCount() - start) * 1000. / getTickFrequency() / iterations;
+                // Grouping order depends on the threads, the rectangles
+                // must not
+                sort(objects.begin(), objects.end(), rectLess);
+                if (threads[k] == 1) {
+                    single = time;
+                    reference = objects;
+                }
+
+                char size[32];
+                sprintf(size, "%dx%d", frame.cols, frame.rows);
+                printf("%-10s %7u %10.2f %7.2fx %9.0f%% %8u\n", size, static_cast<unsigned>(threads[k]), time,
+                        single / time, single / time / threads[k] * 100, static_cast<unsigned>(objects.size()));
+                if (objects != reference) {
+                    fprintf(stderr, "%u threads found other objects than 1 thread at %s\n",
+                            static_cast<unsigned>(threads[k]), size);
+                    return 1;
+                }
+            }
+        }
+    } catch (std::exception& e) {
+        fprintf(stderr, "cascadebench: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*******************************************
+ *
+ *	colorlutbench
+ *   Compares HSV threshold classification of the color
+ *   detector with the precomputed RGB table, time per
+ *   frame and labels that differ.
+ *
+ ********************************************/
+
+#include <cv.h>
+
+#include <boost/thread/thread.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "colordetector.h"
+#include "syntheticsource.h"
+
+using namespace cv;
+
+static void addColors(ColorDetector& detector) {
+    // Colors of the synthetic blobs, red wraps around hue 0
+    detector.setColor(Scalar(170, 100, 100, 0), Scalar(10, 255, 255, 0));
+    detector.addColor("green", Scalar(50, 100, 100, 0), Scalar(70, 255, 255, 0));
+    detector.addColor("blue", Scalar(110, 100, 100, 0), Scalar(130, 255, 255, 0));
+}
+
+static double classifyTime(ColorDetector& detector, const Mat& frame, Mat& labels, int iterations) {
+    detector.classify(frame, labels);
+    int64 start = getTickCount();
+    for (int n = 0; n < iterations; ++n)
+        detector.classify(frame, labels);
+    return (getTickCount() - start) * 1000. / getTickFrequency() / iterations;
+}
+
+int main(int argc, char** argv) {
+    const int sizes[][2] = {{320, 240}, {640, 480}, {1280, 720}, {1920, 1080}};
+    const int bits[] = {5, 6};
+    const int iterations = argc > 1 ? atoi(argv[1]) : 200;
+
+    printf("%-10s %5s %11s %11s %8s %10s\n", "size", "bits", "hsv [ms]", "table [ms]", "speedup", "differ [%]");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        SyntheticSource source(sizes[i][0], sizes[i][1], 0, "blobs+noise");
+        Mat frame;
+        if (!source.grab() || !source.retrieve(frame)) {
+            fprintf(stderr, "No synthetic frame of %dx%d\n", sizes[i][0], sizes[i][1]);
+            return 1;
+        }
+        // Sources give BGR, the detector takes RGB
+        cvtColor(frame, frame, CV_BGR2RGB);
+
+        ColorDetector hsv;
+        addColors(hsv);
+        Mat hsvLabels;
+        double hsvTime = classifyTime(hsv, frame, hsvLabels, iterations);
+
+        for (size_t k = 0; k < sizeof(bits) / sizeof(bits[0]); ++k) {
+            ColorDetector table;
+            addColors(table);
+            table.setClassifier(CLASSIFY_RGB_TABLE, bits[k]);
+            while (!table.tableReady())
+                boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+
+            Mat tableLabels;
+            double tableTime = classifyTime(table, frame, tableLabels, iterations);
+            double differ = 100. * countNonZero(hsvLabels != tableLabels) / frame.total();
+
+            char size[32];
+            sprintf(size, "%dx%d", frame.cols, frame.rows);
+            printf("%-10s %5d %11.3f %11.3f %7.2fx %10.3f\n", size, bits[k],
+                    hsvTime, tableTime, hsvTime / tableTime, differ);
+        }
+    }
+    return 0;
+}
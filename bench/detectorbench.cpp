@@ -0,0 +1,447 @@
+/*******************************************
+ *
+ *	detectorbench
+ *   Runs the detector image processing without Urbi on
+ *   frames of a video file, an image directory or the
+ *   synthetic source, over a set of resolutions and scales.
+ *   Reports throughput, latency percentiles and allocations
+ *   per frame, and compares them with a baseline to catch
+ *   regressions.
+ *
+ *   detectorbench [--detector color|colortrack|camshift|object|objecttrack|move|all]
+ *       [--input synthetic|<video>|<directory>]
+ *       [--pattern blobs+noise+face] [--sizes 320x240,640x480]
+ *       [--scales 1,2] [--frames 300] [--warmup 20]
+ *       [--unique 32] [--cascade <file>]
+ *       [--color hmin,hmax,smin,smax,vmin,vmax]
+ *       [--output <csv>] [--baseline <csv>] [--tolerance 0.1]
+ *       [--trace <json>]
+ *
+ *   --trace times the detector stages and writes the last
+ *   ones as Chrome trace JSON. colortrack and camshift are
+ *   the color detector in tracking and CamShift mode,
+ *   objecttrack the object detector in tracking mode.
+ *
+ *   Exit status is 2 if some configuration is slower than
+ *   the baseline by more than the tolerance.
+ *
+ ********************************************/
+
+#include <cv.h>
+#include <highgui.h>
+
+#include <boost/atomic.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "colordetector.h"
+#include "framecache.h"
+#include "movedetector.h"
+#include "objectdetector.h"
+#include "stagetimer.h"
+#include "syntheticsource.h"
+
+using namespace cv;
+using namespace std;
+
+// Heap allocations made through operator new, by the detectors as well as
+// by OpenCV containers. cv::Mat data comes from malloc and is counted by
+// the buffer pools instead.
+static boost::atomic<boost::uint64_t> gAllocations(0);
+
+#if __cplusplus >= 201103L
+#define BAD_ALLOC_SPEC
+#else
+#define BAD_ALLOC_SPEC throw(std::bad_alloc)
+#endif
+
+void* operator new(size_t size) BAD_ALLOC_SPEC {
+    ++gAllocations;
+    void* p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) BAD_ALLOC_SPEC {
+    return operator new(size);
+}
+
+void operator delete(void* p) throw() {
+    free(p);
+}
+
+void operator delete[](void* p) throw() {
+    free(p);
+}
+
+struct Options {
+    Options() : detector("all"), input("synthetic"), pattern("blobs+noise+face"),
+            sizes("320x240,640x480,1280x720"), scales("1,2"), frames(300), warmup(20),
+            unique(32), color("0,10,100,255,100,255"), tolerance(0.1) {}
+
+    string detector;
+    string input;
+    string pattern;
+    string sizes;
+    string scales;
+    int frames; // measured frames per configuration
+    int warmup; // frames processed before measuring
+    int unique; // distinct frames kept in memory
+    string cascade;
+    string color;
+    string output;
+    string baseline;
+    double tolerance;
+    string trace;
+};
+
+struct Result {
+    Result() : fps(0), p50(0), p95(0), p99(0), buffers(0), allocations(0) {}
+
+    string detector;
+    Size size;
+    double scale;
+    double fps;
+    double p50, p95, p99; // latency [ms]
+    double buffers; // image buffers allocated per frame
+    double allocations; // operator new calls per frame
+};
+
+static vector<string> split(const string& text, char separator) {
+    vector<string> tokens;
+    stringstream stream(text);
+    string token;
+    while (getline(stream, token, separator))
+        if (!token.empty())
+            tokens.push_back(token);
+    return tokens;
+}
+
+// Frames of the input converted to RGB of the given size
+static vector<Mat> loadFrames(const Options& options, const Size& size) {
+    vector<Mat> frames;
+    Mat frame, rgb;
+
+    if (options.input == "synthetic") {
+        SyntheticSource source(size.width, size.height, 0, options.pattern);
+        while (static_cast<int>(frames.size()) < options.unique && source.grab() && source.retrieve(frame)) {
+            cvtColor(frame, rgb, CV_BGR2RGB);
+            frames.push_back(rgb.clone());
+        }
+        return frames;
+    }
+
+    vector<string> files;
+    if (boost::filesystem::is_directory(options.input)) {
+        for (boost::filesystem::directory_iterator i(options.input), end; i != end; ++i)
+            files.push_back(i->path().string());
+        sort(files.begin(), files.end());
+    }
+
+    VideoCapture capture;
+    if (files.empty() && !capture.open(options.input))
+        throw runtime_error("Could not open " + options.input);
+
+    for (size_t i = 0; static_cast<int>(frames.size()) < options.unique; ++i) {
+        if (files.empty()) {
+            if (!capture.read(frame))
+                break;
+        } else if (i < files.size()) {
+            frame = imread(files[i]);
+            if (frame.empty())
+                continue;
+        } else
+            break;
+
+        Mat resized;
+        resize(frame, resized, size, 0, 0, INTER_AREA);
+        cvtColor(resized, rgb, CV_BGR2RGB);
+        frames.push_back(rgb.clone());
+    }
+    if (frames.empty())
+        throw runtime_error("No frames in " + options.input);
+    return frames;
+}
+
+// Common interface of the detectors for the measurement loop
+class Runner {
+public:
+    virtual ~Runner() {}
+    virtual void process(const Mat& frame, boost::uint64_t id) = 0;
+    virtual boost::uint64_t buffers() const = 0;
+    virtual StageTimes& times() = 0;
+};
+
+class ColorRunner : public Runner {
+public:
+    ColorRunner(const Options& options, double scale, bool tracking, int mode) {
+        vector<string> color = split(options.color, ',');
+        if (color.size() != 6)
+            throw runtime_error("Color needs six values");
+        int c[6];
+        for (int i = 0; i < 6; ++i)
+            c[i] = atoi(color[i].c_str());
+        // Same mapping as UColorDetector::setColor
+        mDetector.setColor(Scalar(c[0] * 180 / 255, c[2], c[4], 0), Scalar(c[1] * 180 / 255, c[3], c[5], 0));
+        mDetector.setScale(scale);
+        mDetector.setTracking(tracking);
+        mDetector.setMode(mode);
+    }
+    virtual void process(const Mat& frame, boost::uint64_t id) { mDetector.process(frame, "bench", id); }
+    virtual boost::uint64_t buffers() const { return mDetector.allocations(); }
+    virtual StageTimes& times() { return mDetector.times(); }
+
+private:
+    ColorDetector mDetector;
+};
+
+class ObjectRunner : public Runner {
+public:
+    ObjectRunner(const Options& options, double scale, bool tracking) {
+        if (!mDetector.load(options.cascade))
+            throw runtime_error("Could not load cascade classifier " + options.cascade);
+        mDetector.setScale(scale);
+        mDetector.setTracking(tracking);
+    }
+    virtual void process(const Mat& frame, boost::uint64_t id) { mDetector.process(frame, "bench", id); }
+    virtual boost::uint64_t buffers() const { return 0; }
+    virtual StageTimes& times() { return mDetector.times(); }
+
+private:
+    ObjectDetector mDetector;
+};
+
+class MoveRunner : public Runner {
+public:
+    MoveRunner(const Options&, double scale) { mDetector.setScale(scale); }
+    virtual void process(const Mat& frame, boost::uint64_t id) { mDetector.process(frame, "bench", id); }
+    virtual boost::uint64_t buffers() const { return mDetector.allocations(); }
+    virtual StageTimes& times() { return mDetector.times(); }
+
+private:
+    MoveDetector mDetector;
+};
+
+static Runner* createRunner(const string& detector, const Options& options, double scale) {
+    if (detector == "color")
+        return new ColorRunner(options, scale, false, COLOR_SEGMENTATION);
+    if (detector == "colortrack")
+        return new ColorRunner(options, scale, true, COLOR_SEGMENTATION);
+    if (detector == "camshift")
+        return new ColorRunner(options, scale, false, COLOR_CAMSHIFT);
+    if (detector == "object")
+        return new ObjectRunner(options, scale, false);
+    if (detector == "objecttrack")
+        return new ObjectRunner(options, scale, true);
+    if (detector == "move")
+        return new MoveRunner(options, scale);
+    throw runtime_error("Unknown detector " + detector);
+}
+
+static double percentile(const vector<double>& sorted, double fraction) {
+    size_t i = static_cast<size_t>(fraction * sorted.size());
+    return sorted[i < sorted.size() ? i : sorted.size() - 1];
+}
+
+static Result run(const string& detector, const Options& options, const vector<Mat>& frames, double scale) {
+    Runner* runner = createRunner(detector, options, scale);
+    char owner[128];
+    sprintf(owner, "%s %dx%d /%g", detector.c_str(), frames[0].cols, frames[0].rows, scale);
+    runner->times().setOwner(owner);
+    runner->times().enable(!options.trace.empty());
+    FrameCache& cache = FrameCache::instance();
+    // Frame ids are never repeated, so every frame is processed from scratch
+    static boost::uint64_t id = 0;
+
+    for (int n = 0; n < options.warmup; ++n)
+        runner->process(frames[n % frames.size()], ++id);
+
+    vector<double> latencies;
+    latencies.reserve(options.frames);
+    boost::uint64_t buffers = runner->buffers() + cache.allocations();
+    boost::uint64_t allocations = gAllocations;
+    int64 start = getTickCount();
+    for (int n = 0; n < options.frames; ++n) {
+        int64 frameStart = getTickCount();
+        runner->process(frames[(options.warmup + n) % frames.size()], ++id);
+        latencies.push_back((getTickCount() - frameStart) * 1000. / getTickFrequency());
+    }
+    double time = (getTickCount() - start) / getTickFrequency();
+    // The push_backs above were reserved, nothing of the loop itself counts
+    allocations = gAllocations - allocations;
+    buffers = runner->buffers() + cache.allocations() - buffers;
+    delete runner;
+
+    Result result;
+    result.detector = detector;
+    result.size = frames[0].size();
+    result.scale = scale;
+    result.fps = options.frames / time;
+    sort(latencies.begin(), latencies.end());
+    result.p50 = percentile(latencies, 0.5);
+    result.p95 = percentile(latencies, 0.95);
+    result.p99 = percentile(latencies, 0.99);
+    result.buffers = static_cast<double>(buffers) / options.frames;
+    result.allocations = static_cast<double>(allocations) / options.frames;
+    return result;
+}
+
+static string key(const string& detector, int width, int height, double scale) {
+    char text[128];
+    sprintf(text, "%s %dx%d /%g", detector.c_str(), width, height, scale);
+    return text;
+}
+
+// Frames per second of every configuration in a csv written by --output
+static map<string, double> loadBaseline(const string& path) {
+    ifstream file(path.c_str());
+    if (!file)
+        throw runtime_error("Could not open baseline " + path);
+    map<string, double> baseline;
+    string line;
+    getline(file, line); // header
+    while (getline(file, line)) {
+        vector<string> fields = split(line, ',');
+        if (fields.size() < 5)
+            continue;
+        baseline[key(fields[0], atoi(fields[1].c_str()), atoi(fields[2].c_str()), atof(fields[3].c_str()))] =
+                atof(fields[4].c_str());
+    }
+    return baseline;
+}
+
+static Options parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string name = argv[i];
+        string value = argv[i + 1];
+        if (name == "--detector")
+            options.detector = value;
+        else if (name == "--input")
+            options.input = value;
+        else if (name == "--pattern")
+            options.pattern = value;
+        else if (name == "--sizes")
+            options.sizes = value;
+        else if (name == "--scales")
+            options.scales = value;
+        else if (name == "--frames")
+            options.frames = atoi(value.c_str());
+        else if (name == "--warmup")
+            options.warmup = atoi(value.c_str());
+        else if (name == "--unique")
+            options.unique = atoi(value.c_str());
+        else if (name == "--cascade")
+            options.cascade = value;
+        else if (name == "--color")
+            options.color = value;
+        else if (name == "--output")
+            options.output = value;
+        else if (name == "--baseline")
+            options.baseline = value;
+        else if (name == "--tolerance")
+            options.tolerance = atof(value.c_str());
+        else if (name == "--trace")
+            options.trace = value;
+        else
+            throw runtime_error("Unknown option " + name);
+    }
+    if (argc % 2 == 0)
+        throw runtime_error(string("Missing value of ") + argv[argc - 1]);
+    if (options.frames <= 0 || options.warmup < 0 || options.unique <= 0)
+        throw runtime_error("Frame counts should be positive");
+    return options;
+}
+
+int main(int argc, char** argv) {
+    try {
+        Options options = parseOptions(argc, argv);
+
+        vector<string> detectors;
+        if (options.detector == "all") {
+            detectors.push_back("color");
+            detectors.push_back("colortrack");
+            detectors.push_back("camshift");
+            // Object detection needs a cascade, skipped without one
+            if (!options.cascade.empty()) {
+                detectors.push_back("object");
+                detectors.push_back("objecttrack");
+            }
+            detectors.push_back("move");
+        } else
+            detectors = split(options.detector, ',');
+
+        map<string, double> baseline;
+        if (!options.baseline.empty())
+            baseline = loadBaseline(options.baseline);
+
+        vector<Result> results;
+        bool regression = false;
+        vector<string> sizes = split(options.sizes, ',');
+        vector<string> scales = split(options.scales, ',');
+        printf("%-8s %-10s %6s %9s %9s %9s %9s %9s %9s\n", "detector", "size", "scale",
+                "fps", "p50 [ms]", "p95 [ms]", "p99 [ms]", "buffers", "new");
+        for (size_t s = 0; s < sizes.size(); ++s) {
+            int width = 0, height = 0;
+            if (sscanf(sizes[s].c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+                throw runtime_error("Bad size " + sizes[s]);
+            vector<Mat> frames = loadFrames(options, Size(width, height));
+
+            for (size_t d = 0; d < detectors.size(); ++d)
+                for (size_t k = 0; k < scales.size(); ++k) {
+                    Result result = run(detectors[d], options, frames, atof(scales[k].c_str()));
+                    results.push_back(result);
+
+                    char size[32];
+                    sprintf(size, "%dx%d", result.size.width, result.size.height);
+                    printf("%-8s %-10s %6g %9.1f %9.3f %9.3f %9.3f %9.3f %9.3f", result.detector.c_str(), size,
+                            result.scale, result.fps, result.p50, result.p95, result.p99, result.buffers,
+                            result.allocations);
+
+                    map<string, double>::const_iterator i = baseline.find(
+                            key(result.detector, result.size.width, result.size.height, result.scale));
+                    if (i != baseline.end()) {
+                        printf(" %+6.1f%%", (result.fps / i->second - 1) * 100);
+                        if (result.fps < i->second * (1 - options.tolerance)) {
+                            printf(" REGRESSION");
+                            regression = true;
+                        }
+                    }
+                    printf("\n");
+                }
+        }
+
+        if (!options.output.empty()) {
+            ofstream file(options.output.c_str());
+            file << "detector,width,height,scale,fps,p50,p95,p99,buffers,new\n";
+            for (size_t i = 0; i < results.size(); ++i)
+                file << results[i].detector << ',' << results[i].size.width << ',' << results[i].size.height << ','
+                        << results[i].scale << ',' << results[i].fps << ',' << results[i].p50 << ','
+                        << results[i].p95 << ',' << results[i].p99 << ',' << results[i].buffers << ','
+                        << results[i].allocations << '\n';
+            if (!file)
+                throw runtime_error("Could not write " + options.output);
+        }
+        if (!options.trace.empty()) {
+            ofstream file(options.trace.c_str());
+            writeStageTrace(file);
+            if (!file)
+                throw runtime_error("Could not write " + options.trace);
+        }
+        return regression ? 2 : 0;
+    } catch (std::exception& e) {
+        fprintf(stderr, "detectorbench: %s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,77 @@
+/*******************************************
+ *
+ *	orientbench
+ *   Compares fused orientation kernel with the
+ *   flip + transpose + cvtColor chain formerly used in
+ *   the UCamera grab thread.
+ *
+ ********************************************/
+
+#include <cv.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "orientation.h"
+
+using namespace cv;
+
+// Chain used by UCamera before the fused kernel
+static void orientChain(const Mat& src, Mat& dst, int orientation) {
+    Mat tmp;
+    switch (orientation) {
+    case ORIENT_D90:
+        cv::flip(src, tmp, 1);
+        transpose(tmp, dst);
+        break;
+    case ORIENT_D180:
+        cv::flip(src, dst, -1);
+        break;
+    case ORIENT_D270:
+        cv::flip(src, tmp, 0);
+        transpose(tmp, dst);
+        break;
+    default:
+        src.copyTo(dst);
+        break;
+    }
+    cvtColor(dst, dst, CV_BGR2RGB);
+}
+
+int main(int argc, char** argv) {
+    const int sizes[][2] = {{320, 240}, {640, 480}, {1280, 720}, {1920, 1080}};
+    const int iterations = argc > 1 ? atoi(argv[1]) : 200;
+
+    printf("%-10s %6s %12s %12s %8s\n", "size", "flip", "chain [ms]", "fused [ms]", "speedup");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        Mat src(sizes[i][1], sizes[i][0], CV_8UC3);
+        randu(src, Scalar::all(0), Scalar::all(256));
+
+        for (int orientation = ORIENT_D0; orientation <= ORIENT_D270; ++orientation) {
+            Mat chain, fused;
+            orientChain(src, chain, orientation);
+            orient(src, fused, orientation);
+            if (norm(chain, fused, NORM_INF) != 0) {
+                fprintf(stderr, "Fused kernel differs from chain for %dx%d, flip %d\n",
+                        src.cols, src.rows, orientation);
+                return 1;
+            }
+
+            int64 start = getTickCount();
+            for (int n = 0; n < iterations; ++n)
+                orientChain(src, chain, orientation);
+            double chainTime = (getTickCount() - start) * 1000. / getTickFrequency() / iterations;
+
+            start = getTickCount();
+            for (int n = 0; n < iterations; ++n)
+                orient(src, fused, orientation);
+            double fusedTime = (getTickCount() - start) * 1000. / getTickFrequency() / iterations;
+
+            char size[32];
+            sprintf(size, "%dx%d", src.cols, src.rows);
+            printf("%-10s %6d %12.3f %12.3f %7.2fx\n", size, orientation * 90,
+                    chainTime, fusedTime, chainTime / fusedTime);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*******************************************
+ *
+ *	BatchReader
+ *   Decodes frames ahead of their processing.
+ *
+ ********************************************/
+
+#include "batchreader.h"
+
+#include <highgui.h>
+
+#include <exception>
+#include <stdexcept>
+
+using namespace cv;
+using namespace std;
+
+BatchReader::BatchReader(const string& path, size_t depth) :
+        mReplay(0), mCapture(0), mNextFile(0), mDepth(depth > 0 ? depth : 1), mEnd(false) {
+    // Recordings are served straight from their mapping
+    if (ReplaySource::isRecording(path)) {
+        mReplay = new ReplaySource(path, false);
+        mSource.reset(mReplay);
+    } else {
+        mCapture = new CaptureSource(path);
+        mSource.reset(mCapture);
+        if (!mCapture->isOpened())
+            throw runtime_error("Could not open video " + path);
+    }
+    start();
+}
+
+BatchReader::BatchReader(const vector<string>& files, size_t depth) :
+        mReplay(0), mCapture(0), mFiles(files), mNextFile(0), mDepth(depth > 0 ? depth : 1), mEnd(false) {
+    start();
+}
+
+BatchReader::~BatchReader() {
+    mDecodeThread.interrupt();
+    mDecodeThread.join();
+}
+
+void BatchReader::start() {
+    mDecodeThread = boost::thread(&BatchReader::decodeThreadFunction, this);
+}
+
+bool BatchReader::next(Mat& frame, double& timestamp) {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    while (mFrames.empty() && !mEnd)
+        mCond.wait(lock);
+    if (mFrames.empty()) {
+        if (!mError.empty())
+            throw runtime_error(mError);
+        return false;
+    }
+    frame = mFrames.front().image;
+    timestamp = mFrames.front().timestamp;
+    mFrames.pop_front();
+    mCond.notify_all();
+    return true;
+}
+
+bool BatchReader::decode(Frame& frame) {
+    if (mSource) {
+        if (!mSource->grab() || !mSource->retrieve(mDecoded))
+            return false;
+        frame.timestamp = mReplay ? mReplay->timestamp() / 1e6 : mCapture->position();
+        // RGB recordings and grayscale frames are used as they are
+        if (mDecoded.channels() == 1 || mSource->rgb()) {
+            frame.image = mDecoded;
+            return true;
+        }
+    } else {
+        if (mNextFile >= mFiles.size())
+            return false;
+        mDecoded = imread(mFiles[mNextFile]);
+        if (mDecoded.empty())
+            throw runtime_error("Could not read image " + mFiles[mNextFile]);
+        frame.timestamp = mNextFile / 25.;
+        ++mNextFile;
+    }
+
+    // Buffers come back once the consumer is done with their frames
+    frame.image = mBuffers.take(mDecoded.size(), CV_8UC3);
+    cvtColor(mDecoded, frame.image, CV_BGR2RGB);
+    return true;
+}
+
+void BatchReader::decodeThreadFunction() {
+    try {
+        while (true) {
+            {
+                boost::unique_lock<boost::mutex> lock(mMutex);
+                while (mFrames.size() >= mDepth)
+                    mCond.wait(lock);
+            }
+
+            Frame frame;
+            bool decoded = decode(frame);
+
+            boost::lock_guard<boost::mutex> lock(mMutex);
+            if (decoded)
+                mFrames.push_back(frame);
+            else
+                mEnd = true;
+            mCond.notify_all();
+            if (mEnd)
+                return;
+        }
+    } catch (boost::thread_interrupted&) {
+        return;
+    } catch (std::exception& e) {
+        boost::lock_guard<boost::mutex> lock(mMutex);
+        mError = e.what();
+        mEnd = true;
+        mCond.notify_all();
+    }
+}
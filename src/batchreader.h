@@ -0,0 +1,69 @@
+/*******************************************
+ *
+ *	BatchReader
+ *   Decodes frames of a video file, a UCamera recording or
+ *   a list of image files on its own thread, a few frames
+ *   ahead of the consumer, so offline processing overlaps
+ *   decoding with detection.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_BATCHREADER_H
+#define URBICAMERA_BATCHREADER_H
+
+#include <cv.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "framerecord.h"
+#include "framesource.h"
+#include "scratchpool.h"
+
+class BatchReader : boost::noncopyable {
+public:
+    // Frames of a video file or a UCamera recording, depth - frames decoded
+    // ahead
+    explicit BatchReader(const std::string& path, size_t depth = 4);
+    // Frames of image files in the given order
+    explicit BatchReader(const std::vector<std::string>& files, size_t depth = 4);
+    ~BatchReader();
+
+    // Next frame, RGB or grayscale, and its time [s] (recorded, video
+    // position or 25 fps for image files, only differences are meaningful).
+    // False after the last one. Throws if decoding failed.
+    bool next(cv::Mat& frame, double& timestamp);
+
+private:
+    struct Frame {
+        cv::Mat image;
+        double timestamp;
+    };
+
+    void start();
+    bool decode(Frame& frame); // runs in the decoding thread
+    void decodeThreadFunction();
+
+    boost::scoped_ptr<FrameSource> mSource; // video or recording
+    ReplaySource* mReplay; // mSource if it is a recording
+    CaptureSource* mCapture; // mSource if it is a video
+    std::vector<std::string> mFiles; // image files if no source
+    size_t mNextFile;
+    ScratchPool mBuffers; // RGB frames, used by the decoding thread only
+    cv::Mat mDecoded;
+
+    size_t mDepth;
+    boost::mutex mMutex;
+    boost::condition_variable mCond;
+    std::deque<Frame> mFrames; // decoded frames, guarded by mMutex
+    bool mEnd; // no more frames will come, guarded by mMutex
+    std::string mError; // decoding failure, guarded by mMutex
+    boost::thread mDecodeThread;
+};
+
+#endif
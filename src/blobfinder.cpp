@@ -0,0 +1,145 @@
+/*******************************************
+ *
+ *	BlobFinder
+ *   Connected regions of label images.
+ *
+ ********************************************/
+
+#include "blobfinder.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace cv;
+using namespace std;
+
+static bool largerArea(const Blob& a, const Blob& b) {
+    return a.area > b.area;
+}
+
+void BlobFinder::begin(int width, int bits, const Point& origin) {
+    if (bits < 0 || bits > MAX_BITS)
+        throw runtime_error("Too many label bits");
+    mWidth = width;
+    mOrigin = origin;
+    mBits = bits;
+    mRow = 0;
+    // Vectors keep their capacity, a steady stream allocates nothing
+    for (int i = 0; i < MAX_BITS; ++i) {
+        mRuns[i].runs.clear();
+        mRuns[i].previous = mRuns[i].current = 0;
+        mBlobs[i].clear();
+    }
+}
+
+void BlobFinder::addRow(const uchar* labels) {
+    for (int i = 0; i < mBits; ++i) {
+        mRuns[i].previous = mRuns[i].current;
+        mRuns[i].current = mRuns[i].runs.size();
+    }
+
+    // Only changes of the label start or end runs
+    unsigned int mask = (1u << mBits) - 1;
+    unsigned int last = 0;
+    int starts[MAX_BITS];
+    for (int c = 0; c < mWidth; ++c) {
+        unsigned int value = labels[c] & mask;
+        if (value == last)
+            continue;
+        unsigned int changed = value ^ last;
+        for (int i = 0; changed; ++i, changed >>= 1)
+            if (changed & 1) {
+                if (last & (1u << i))
+                    close(i, starts[i], c);
+                else
+                    starts[i] = c;
+            }
+        last = value;
+    }
+    for (int i = 0; last; ++i, last >>= 1)
+        if (last & 1)
+            close(i, starts[i], mWidth);
+    ++mRow;
+}
+
+void BlobFinder::close(int bit, int start, int end) {
+    Runs& runs = mRuns[bit];
+    Run run;
+    run.row = mRow;
+    run.start = start;
+    run.end = end;
+    run.parent = static_cast<int>(runs.runs.size());
+    runs.runs.push_back(run);
+
+    // Runs of the previous row are sorted, skip those left of this one
+    // and join those touching it, diagonal neighbours included
+    while (runs.previous < runs.current && runs.runs[runs.previous].end < start)
+        ++runs.previous;
+    for (size_t k = runs.previous; k < runs.current && runs.runs[k].start <= end; ++k) {
+        int a = find(runs.runs, static_cast<int>(k));
+        int b = find(runs.runs, run.parent);
+        // Earlier run stays the root
+        if (a < b)
+            runs.runs[b].parent = a;
+        else if (b < a)
+            runs.runs[a].parent = b;
+    }
+}
+
+int BlobFinder::find(vector<Run>& runs, int i) {
+    int root = i;
+    while (runs[root].parent != root)
+        root = runs[root].parent;
+    while (runs[i].parent != root) {
+        int next = runs[i].parent;
+        runs[i].parent = root;
+        i = next;
+    }
+    return root;
+}
+
+void BlobFinder::end() {
+    for (int bit = 0; bit < mBits; ++bit) {
+        vector<Run>& runs = mRuns[bit].runs;
+        vector<Blob>& blobs = mBlobs[bit];
+        mBlobOf.assign(runs.size(), -1);
+
+        // Roots come before the rest of their region, sums of x and y are
+        // kept in the centroid until the area is known
+        for (size_t i = 0; i < runs.size(); ++i) {
+            const Run& run = runs[i];
+            int root = find(runs, static_cast<int>(i));
+            if (mBlobOf[root] < 0) {
+                mBlobOf[root] = static_cast<int>(blobs.size());
+                blobs.push_back(Blob());
+                blobs.back().box = Rect(run.start, run.row, run.end - run.start, 1);
+            }
+            Blob& blob = blobs[mBlobOf[root]];
+            double length = run.end - run.start;
+            blob.area += length;
+            blob.centroid.x += (run.start + run.end - 1) * length / 2;
+            blob.centroid.y += run.row * length;
+            int left = min(blob.box.x, run.start);
+            int right = max(blob.box.x + blob.box.width, run.end);
+            blob.box = Rect(left, blob.box.y, right - left, run.row + 1 - blob.box.y);
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < blobs.size(); ++i)
+            if (blobs[i].area >= mMinArea && blobs[i].area > 0) {
+                blobs[kept] = blobs[i];
+                blobs[kept].centroid.x = blobs[kept].centroid.x / blobs[kept].area + mOrigin.x;
+                blobs[kept].centroid.y = blobs[kept].centroid.y / blobs[kept].area + mOrigin.y;
+                blobs[kept].box.x += mOrigin.x;
+                blobs[kept].box.y += mOrigin.y;
+                ++kept;
+            }
+        blobs.resize(kept);
+        if (blobs.size() > mMaxBlobs) {
+            partial_sort(blobs.begin(), blobs.begin() + mMaxBlobs, blobs.end(), largerArea);
+            blobs.resize(mMaxBlobs);
+        } else {
+            sort(blobs.begin(), blobs.end(), largerArea);
+        }
+    }
+}
@@ -0,0 +1,86 @@
+/*******************************************
+ *
+ *	BlobFinder
+ *   Connected regions of label images, fed row by row
+ *   while the labels are computed.
+ *
+ *   Every bit of a label is a separate region class. Rows
+ *   are split into runs of pixels sharing a bit, runs
+ *   touching a run of the row above (8-connectivity) are
+ *   joined by union-find, so one scan of the labels gives
+ *   the area, bounding box and centroid of every region.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_BLOBFINDER_H
+#define URBICAMERA_BLOBFINDER_H
+
+#include <cv.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <vector>
+
+struct Blob {
+    Blob() : area(0) {}
+
+    double area; // pixels
+    cv::Rect box;
+    cv::Point2d centroid;
+};
+
+class BlobFinder : boost::noncopyable {
+public:
+    static const int MAX_BITS = 8;
+
+    BlobFinder() : mMinArea(0), mMaxBlobs(8), mBits(0), mWidth(0), mRow(0) {}
+
+    // Regions smaller than area pixels are ignored
+    void setMinArea(double area) { mMinArea = area; }
+    double minArea() const { return mMinArea; }
+    // Only the largest count regions of every bit are kept, at least one
+    void setMaxBlobs(size_t count) { mMaxBlobs = count > 0 ? count : 1; }
+    size_t maxBlobs() const { return mMaxBlobs; }
+
+    // Starts an image width pixels wide, labels use the lowest bits bits.
+    // Regions are reported relative to origin, the position of the image
+    // when it is a window of a larger one.
+    void begin(int width, int bits, const cv::Point& origin = cv::Point());
+    // Labels of the next row, rows come in order from 0
+    void addRow(const uchar* labels);
+    // Computes the regions of the rows added since begin
+    void end();
+
+    // Regions of bit, largest first
+    const std::vector<Blob>& blobs(int bit) const { return mBlobs[bit]; }
+
+private:
+    struct Run {
+        int row;
+        int start;
+        int end; // past the last pixel
+        int parent; // union-find, index of a run of the same region
+    };
+
+    // Runs of one bit, rows are consecutive ranges of runs
+    struct Runs {
+        std::vector<Run> runs;
+        size_t previous; // first run of the previous row
+        size_t current; // first run of the current row
+    };
+
+    void close(int bit, int start, int end);
+    static int find(std::vector<Run>& runs, int i);
+
+    double mMinArea;
+    size_t mMaxBlobs;
+    int mBits;
+    int mWidth;
+    cv::Point mOrigin;
+    int mRow;
+    Runs mRuns[MAX_BITS];
+    std::vector<Blob> mBlobs[MAX_BITS];
+    std::vector<int> mBlobOf; // blob of every root run, scratch of end
+};
+
+#endif
@@ -0,0 +1,458 @@
+/*******************************************
+ *
+ *	ColorDetector
+ *   Finds regions of HSV color ranges.
+ *
+ ********************************************/
+
+#include "colordetector.h"
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include "workerpool.h"
+
+using namespace cv;
+using namespace std;
+
+struct ColorDetector::RgbTable {
+    int bits;
+    boost::uint64_t generation; // colors it was built for
+    vector<uchar> classes; // color bits of every quantized RGB
+};
+
+struct ColorDetector::TableSlot {
+    TableSlot() : generation(0) {}
+
+    boost::atomic<boost::uint64_t> generation; // of the latest colors
+    boost::shared_ptr<const RgbTable> table; // accessed with atomic_load/store
+};
+
+// Tables are built in order of requests, one at a time
+static WorkerPool& tablePool() {
+    static WorkerPool pool(1);
+    return pool;
+}
+
+ColorDetector::ColorDetector() : mScale(1), mClassifier(CLASSIFY_HSV), mTableBits(5), mSlot(new TableSlot),
+        mTracking(false), mFullScanInterval(10), mWindowedFrames(0), mLost(true), mProcessedFraction(1),
+        mMode(COLOR_SEGMENTATION) {
+    mColor.hsvMin = mColor.hsvMax = Scalar(0, 0, 0, 0);
+    // About what the former 13x13 median filter removed
+    setMinArea(50);
+    updateTables();
+}
+
+void ColorDetector::setScale(double scale) {
+    mScale = scale > 1.0 ? scale : 1.0;
+}
+
+void ColorDetector::setColor(const Scalar& hsvMin, const Scalar& hsvMax) {
+    mColor.hsvMin = hsvMin;
+    mColor.hsvMax = hsvMax;
+    updateTables();
+    // Histogram of another color is useless
+    mTracker.reset();
+}
+
+void ColorDetector::addColor(const string& name, const Scalar& hsvMin, const Scalar& hsvMax) {
+    Color color;
+    color.name = name;
+    color.hsvMin = hsvMin;
+    color.hsvMax = hsvMax;
+    for (size_t i = 0; i < mColors.size(); ++i)
+        if (mColors[i].name == name) {
+            mColors[i] = color;
+            updateTables();
+            return;
+        }
+    if (mColors.size() >= MAX_COLORS)
+        throw runtime_error("Too many colors");
+    mColors.push_back(color);
+    updateTables();
+}
+
+bool ColorDetector::removeColor(const string& name) {
+    for (size_t i = 0; i < mColors.size(); ++i)
+        if (mColors[i].name == name) {
+            mColors.erase(mColors.begin() + i);
+            updateTables();
+            return true;
+        }
+    return false;
+}
+
+void ColorDetector::setColors(const vector<Color>& colors) {
+    if (colors.size() > MAX_COLORS)
+        throw runtime_error("Too many colors");
+    mColors = colors;
+    updateTables();
+}
+
+void ColorDetector::updateTables() {
+    memset(mTables, 0, sizeof(mTables));
+    for (size_t i = 0; i <= mColors.size(); ++i) {
+        const Color& color = i == 0 ? mColor : mColors[i - 1];
+        uchar bit = static_cast<uchar>(1 << i);
+        for (int channel = 0; channel < 3; ++channel) {
+            int low = cvRound(color.hsvMin[channel]);
+            int high = cvRound(color.hsvMax[channel]);
+            for (int value = 0; value < 256; ++value) {
+                // Same bounds as inRange, hue may wrap around
+                bool inside = low <= high ? (value >= low && value <= high)
+                        : (channel == 0 && (value >= low || value <= high));
+                if (inside)
+                    mTables[channel][value] |= bit;
+            }
+        }
+    }
+    mResults.assign(mColors.size(), ColorResult());
+    // Regions of the old colors say nothing about the new ones
+    mTracks.assign(mColors.size() + 1, Track());
+    mLost = true;
+    if (mClassifier == CLASSIFY_RGB_TABLE)
+        requestTable();
+}
+
+void ColorDetector::setClassifier(int classifier, int bits) {
+    if (classifier != CLASSIFY_HSV && classifier != CLASSIFY_RGB_TABLE)
+        throw runtime_error("Unknown color classifier");
+    if (bits < 4 || bits > 7)
+        throw runtime_error("RGB table needs 4 to 7 bits per channel");
+    bool changed = classifier != mClassifier || bits != mTableBits;
+    mClassifier = classifier;
+    mTableBits = bits;
+    if (changed && mClassifier == CLASSIFY_RGB_TABLE)
+        requestTable();
+}
+
+void ColorDetector::setTracking(bool tracking, int interval) {
+    if (tracking != mTracking)
+        mLost = true;
+    mTracking = tracking;
+    mFullScanInterval = interval > 0 ? interval : 0;
+}
+
+void ColorDetector::setMode(int mode) {
+    if (mode != COLOR_SEGMENTATION && mode != COLOR_CAMSHIFT)
+        throw runtime_error("Unknown color detection mode");
+    if (mode != mMode) {
+        mTracker.reset();
+        mLost = true;
+    }
+    mMode = mode;
+}
+
+void ColorDetector::learnHistogram(const Rect& roi) {
+    mTracker.reset();
+    mLearnRoi = roi;
+}
+
+bool ColorDetector::tableReady() const {
+    boost::shared_ptr<const RgbTable> table = boost::atomic_load(&mSlot->table);
+    return table && table->bits == mTableBits && table->generation == mSlot->generation;
+}
+
+void ColorDetector::requestTable() {
+    vector<uchar> tables(&mTables[0][0], &mTables[0][0] + sizeof(mTables));
+    boost::uint64_t generation = ++mSlot->generation;
+    tablePool().post(boost::bind(&ColorDetector::buildTable, mSlot, generation, mTableBits, tables));
+}
+
+void ColorDetector::buildTable(boost::shared_ptr<TableSlot> slot, boost::uint64_t generation, int bits,
+        vector<uchar> tables) {
+    // Colors changed again, a newer build is queued
+    if (slot->generation != generation)
+        return;
+
+    // Classify the center of every quantization cell the same way as the
+    // HSV path classifies pixels
+    int bins = 1 << bits;
+    int shift = 8 - bits;
+    int half = (1 << shift) / 2;
+    Mat centers(bins * bins * bins, 1, CV_8UC3);
+    uchar* center = centers.ptr(0);
+    for (int r = 0; r < bins; ++r)
+        for (int g = 0; g < bins; ++g)
+            for (int b = 0; b < bins; ++b, center += 3) {
+                center[0] = static_cast<uchar>((r << shift) + half);
+                center[1] = static_cast<uchar>((g << shift) + half);
+                center[2] = static_cast<uchar>((b << shift) + half);
+            }
+    Mat hsv;
+    cvtColor(centers, hsv, CV_RGB2HSV);
+
+    boost::shared_ptr<RgbTable> table(new RgbTable);
+    table->bits = bits;
+    table->generation = generation;
+    table->classes.resize(centers.rows);
+    const uchar* value = hsv.ptr(0);
+    for (size_t i = 0; i < table->classes.size(); ++i, value += 3)
+        table->classes[i] = tables[value[0]] & tables[256 + value[1]] & tables[512 + value[2]];
+    boost::atomic_store(&slot->table, boost::shared_ptr<const RgbTable>(table));
+}
+
+void ColorDetector::classify(const Mat& rgb, Mat& labels) {
+    labels.create(rgb.size(), CV_8UC1);
+    classify(rgb, labels, Rect(0, 0, rgb.cols, rgb.rows), 0);
+}
+
+void ColorDetector::classify(const Mat& rgbImage, Mat& labelImage, const Rect& window, BlobFinder* blobs) {
+    // Windows of the images, the HSV buffer stays full size so it is not
+    // reallocated when the window changes
+    Mat rgb = rgbImage(window);
+    Mat labels = labelImage(window);
+
+    // Table of other colors would credit pixels to the wrong ones, HSV
+    // thresholds are used until the current table is built
+    boost::shared_ptr<const RgbTable> table;
+    if (mClassifier == CLASSIFY_RGB_TABLE) {
+        table = boost::atomic_load(&mSlot->table);
+        if (table && (table->bits != mTableBits || table->generation != mSlot->generation))
+            table.reset();
+    }
+
+    if (!table) {
+        Mat hsvImage = mScratch.get(0, rgbImage.size(), CV_8UC3)(window);
+        {
+            ScopedStage stage(mTimes, STAGE_CONVERT);
+            cvtColor(rgb, hsvImage, CV_RGB2HSV);
+        }
+        ScopedStage stage(mTimes, STAGE_THRESHOLD);
+        label(hsvImage, labels, blobs);
+        return;
+    }
+
+    ScopedStage stage(mTimes, STAGE_THRESHOLD);
+    const uchar* classes = &table->classes[0];
+    int bits = table->bits;
+    int shift = 8 - bits;
+    for (int r = 0; r < rgb.rows; ++r) {
+        const uchar* src = rgb.ptr(r);
+        uchar* dst = labels.ptr(r);
+        for (int c = 0; c < rgb.cols; ++c, src += 3)
+            dst[c] = classes[((src[0] >> shift) << (2 * bits)) | ((src[1] >> shift) << bits) | (src[2] >> shift)];
+        // Runs are split while the row is still in cache
+        if (blobs)
+            blobs->addRow(dst);
+    }
+}
+
+void ColorDetector::label(const Mat& hsv, Mat& labels, BlobFinder* blobs) const {
+    const uchar* hTable = mTables[0];
+    const uchar* sTable = mTables[1];
+    const uchar* vTable = mTables[2];
+    for (int r = 0; r < hsv.rows; ++r) {
+        const uchar* src = hsv.ptr(r);
+        uchar* dst = labels.ptr(r);
+        for (int c = 0; c < hsv.cols; ++c, src += 3)
+            dst[c] = hTable[src[0]] & sTable[src[1]] & vTable[src[2]];
+        if (blobs)
+            blobs->addRow(dst);
+    }
+}
+
+void ColorDetector::process(const Mat& frame, const string& source, boost::uint64_t id) {
+    mInput.begin(source, frame, id);
+
+    // Resize image, skipped if the source is already downscaled or another
+    // detector has already done it
+    Size size(cvRound(frame.cols / mScale), cvRound(frame.rows / mScale));
+    Mat resizedImage;
+    {
+        ScopedStage stage(mTimes, STAGE_RESIZE);
+        resizedImage = mInput.get(size, PREPROCESS_RGB);
+    }
+
+    {
+        ScopedStage stage(mTimes, STAGE_CONVERT);
+        // Copy image to mResult as grayscaled image, cached images are
+        // shared so it has to be a copy
+        mInput.get(size, PREPROCESS_GRAY_RGB).copyTo(mResult);
+    }
+
+    if (mMode == COLOR_CAMSHIFT && mLearnRoi.area() > 0) {
+        mTracker.learn(resizedImage, mLearnRoi);
+        mLearnRoi = Rect();
+    }
+    if (mMode == COLOR_CAMSHIFT && mTracker.learned()) {
+        processCamShift(resizedImage);
+        mInput.end();
+        return;
+    }
+
+    // Label pixels with the colors they match, all colors at once, and
+    // split the labels into regions on the way. Small regions are dropped
+    // by area, cheaper than a median filter and it keeps distinct regions
+    // apart.
+    Mat& labelImage = mScratch.get(1, size, CV_8UC1);
+    Rect full(0, 0, size.width, size.height);
+    if (size != mTrackSize) {
+        mTracks.assign(mTracks.size(), Track());
+        mTrackSize = size;
+        mLost = true;
+    }
+    Rect window = searchWindow(size);
+    if (window != full)
+        // Labels outside the window are left from the last one
+        labelImage(mLabelWindow & full).setTo(Scalar(0));
+    mLabelWindow = window;
+    mProcessedFraction = static_cast<double>(window.area()) / full.area();
+
+    size_t colors = mColors.size() + 1;
+    mBlobs.begin(window.width, static_cast<int>(colors), window.tl());
+    classify(resizedImage, labelImage, window, &mBlobs);
+    mLabels = labelImage;
+    {
+        ScopedStage stage(mTimes, STAGE_MOMENTS);
+        mBlobs.end();
+    }
+
+    ScopedStage stage(mTimes, STAGE_DRAW);
+    // Add detected regions to gray scale image
+    Mat resultWindow = mResult(window);
+    add(resultWindow, resizedImage(window), resultWindow, labelImage(window));
+    mInput.end();
+
+    for (size_t i = 0; i < colors; ++i) {
+        ColorResult& result = i == 0 ? mResult0 : mResults[i - 1];
+        result.blobs = mBlobs.blobs(static_cast<int>(i));
+        for (size_t k = 0; k < result.blobs.size(); ++k)
+            rectangle(mResult, result.blobs[k].box, Scalar(0, 255, 0), 1);
+
+        // Regions touching the border are visible too
+        if (!result.blobs.empty()) {
+            const Blob& largest = result.blobs[0];
+            Point center(cvRound(largest.centroid.x), cvRound(largest.centroid.y));
+            result.position = Point(center.x - mResult.cols / 2, -center.y + mResult.rows / 2);
+            result.area = largest.area;
+            result.visible = true;
+
+            // Draw line from image center to object center
+            line(mResult, center, Point(mResult.cols/2, mResult.rows/2), Scalar(255, 0, 0), 2);
+        } else {
+            result.position = Point(0, 0);
+            result.area = 0;
+            result.visible = false;
+        }
+    }
+    updateTracks(window, size);
+    if (window != full)
+        rectangle(mResult, window, Scalar(255, 255, 0), 1);
+
+    // CamShift starts from the first region of the color, pixels of other
+    // colors in its box are left out of the histogram
+    if (mMode == COLOR_CAMSHIFT && mResult0.visible) {
+        const Rect& box = mResult0.blobs[0].box;
+        Mat& mask = mScratch.get(3, box.size(), CV_8UC1);
+        bitwise_and(labelImage(box), Scalar(1), mask);
+        mTracker.learn(resizedImage, box, mask);
+    }
+
+    drawAxes();
+}
+
+void ColorDetector::processCamShift(const Mat& rgb) {
+    bool found = mTracker.track(rgb, mTimes);
+    mProcessedFraction = mTracker.processedFraction();
+    mLabels = Mat();
+    // Segmentation starts over when switched back
+    mLost = true;
+
+    ScopedStage stage(mTimes, STAGE_DRAW);
+    for (size_t i = 0; i < mResults.size(); ++i)
+        mResults[i] = ColorResult();
+    mResult0.blobs.clear();
+    if (found) {
+        const RotatedRect& box = mTracker.box();
+        Blob blob;
+        blob.area = box.size.area();
+        blob.box = box.boundingRect() & Rect(0, 0, rgb.cols, rgb.rows);
+        blob.centroid = Point2d(box.center.x, box.center.y);
+        mResult0.blobs.push_back(blob);
+
+        Point center(cvRound(box.center.x), cvRound(box.center.y));
+        mResult0.position = Point(center.x - mResult.cols / 2, -center.y + mResult.rows / 2);
+        mResult0.area = blob.area;
+        mResult0.visible = true;
+
+        ellipse(mResult, box, Scalar(0, 255, 0), 2);
+        // Draw line from image center to object center
+        line(mResult, center, Point(mResult.cols/2, mResult.rows/2), Scalar(255, 0, 0), 2);
+    } else {
+        mResult0.position = Point(0, 0);
+        mResult0.area = 0;
+        mResult0.visible = false;
+    }
+    drawAxes();
+}
+
+void ColorDetector::drawAxes() {
+    // Draw horizontal and vertical line in the middle of the image
+    line(mResult, Point(0, mResult.rows/2), Point(mResult.cols, mResult.rows/2), Scalar(100, 100, 100), 1);
+    line(mResult, Point(mResult.cols/2, 0), Point(mResult.cols/2, mResult.rows), Scalar(100, 100, 100), 1);
+}
+
+Rect ColorDetector::searchWindow(const Size& size) const {
+    Rect full(0, 0, size.width, size.height);
+    if (!mTracking || mLost || (mFullScanInterval > 0 && mWindowedFrames >= mFullScanInterval))
+        return full;
+
+    // Regions move on by their velocity, the margin covers half their
+    // size and as much again as they moved
+    Rect window;
+    bool any = false;
+    for (size_t i = 0; i < mTracks.size(); ++i) {
+        const Track& track = mTracks[i];
+        if (!track.valid)
+            continue;
+        int dx = cvRound(track.velocity.x);
+        int dy = cvRound(track.velocity.y);
+        int margin = max(track.box.width, track.box.height) / 2 + max(abs(dx), abs(dy)) + 8;
+        Rect predicted(track.box.x + dx - margin, track.box.y + dy - margin,
+                track.box.width + 2 * margin, track.box.height + 2 * margin);
+        window = any ? (window | predicted) : predicted;
+        any = true;
+    }
+    window &= full;
+    // Nothing to track, or the window is about as costly as everything
+    if (!any || window.area() * 2 > full.area())
+        return full;
+    return window;
+}
+
+void ColorDetector::updateTracks(const Rect& window, const Size& size) {
+    bool fullScan = window == Rect(0, 0, size.width, size.height);
+    mWindowedFrames = fullScan ? 0 : mWindowedFrames + 1;
+    mLost = false;
+    for (size_t i = 0; i < mTracks.size(); ++i) {
+        Track& track = mTracks[i];
+        const ColorResult& result = i == 0 ? mResult0 : mResults[i - 1];
+        // Windows only look for the colors seen by the last full scan
+        if (!fullScan && !track.valid)
+            continue;
+        if (result.blobs.empty()) {
+            mLost = mLost || track.valid;
+            track = Track();
+            continue;
+        }
+
+        const Blob& largest = result.blobs[0];
+        track.velocity = track.valid ? largest.centroid - track.centroid : Point2d();
+        track.box = largest.box;
+        track.centroid = largest.centroid;
+        track.valid = true;
+
+        // Region cut by the window edge may be larger than it looks
+        if (!fullScan && ((largest.box.x == window.x && window.x > 0)
+                || (largest.box.y == window.y && window.y > 0)
+                || (largest.box.br().x == window.br().x && window.br().x < size.width)
+                || (largest.box.br().y == window.br().y && window.br().y < size.height)))
+            mLost = true;
+    }
+}
@@ -0,0 +1,214 @@
+/*******************************************
+ *
+ *	ColorDetector
+ *   Finds regions of HSV color ranges, image processing of
+ *   UColorDetector without the Urbi side, so it can be run
+ *   and profiled offline.
+ *
+ *   Every color owns one bit of a per-pixel label. Lookup
+ *   tables of H, S and V hold the bits of the colors whose
+ *   range contains the value, so a single pass labels the
+ *   image for all colors at once. Connected regions of every
+ *   color are collected from the label rows as they are
+ *   computed, regions below a minimum area are dropped.
+ *
+ *   Instead of converting to HSV the pixels can be
+ *   classified by a table indexed by quantized RGB,
+ *   rebuilt on a worker thread whenever colors change.
+ *   Until it is ready HSV thresholds are used.
+ *
+ *   In tracking mode only a window around the predicted
+ *   regions of the colors seen by the last full scan is
+ *   processed. A full scan follows when a tracked region is
+ *   lost or leaves the window, and periodically to find
+ *   colors that came into view.
+ *
+ *   In CamShift mode the hue/saturation histogram of the
+ *   setColor region (or of a given ROI) is learned once and
+ *   followed by back projection instead of segmentation.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_COLORDETECTOR_H
+#define URBICAMERA_COLORDETECTOR_H
+
+#include <cv.h>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+#include "blobfinder.h"
+#include "framecache.h"
+#include "histogramtracker.h"
+#include "scratchpool.h"
+#include "stagetimer.h"
+
+enum ColorClassifier {
+    CLASSIFY_HSV, // HSV conversion and lookup of every channel
+    CLASSIFY_RGB_TABLE // lookup of quantized RGB
+};
+
+enum ColorMode {
+    COLOR_SEGMENTATION, // regions of the color ranges
+    COLOR_CAMSHIFT // back projection of a learned histogram
+};
+
+class ColorDetector : boost::noncopyable {
+public:
+    struct Color {
+        std::string name;
+        cv::Scalar hsvMin;
+        cv::Scalar hsvMax;
+    };
+
+    struct ColorResult {
+        ColorResult() : visible(false), area(0) {}
+
+        bool visible;
+        // Largest region center relative to the processed image center, y
+        // pointing up
+        cv::Point position;
+        double area; // pixels of the largest region in the processed image
+        std::vector<Blob> blobs; // regions in processed image coordinates, largest first
+    };
+
+    // Named colors besides the one of setColor
+    static const size_t MAX_COLORS = 7;
+
+    ColorDetector();
+
+    // Frames are downscaled by scale before processing, at least 1
+    void setScale(double scale);
+    double scale() const { return mScale; }
+    // Color range, hue in 0-180 as used by OpenCV. Hue range with
+    // minimum above maximum wraps around 0.
+    void setColor(const cv::Scalar& hsvMin, const cv::Scalar& hsvMax);
+    const cv::Scalar& hsvMin() const { return mColor.hsvMin; }
+    const cv::Scalar& hsvMax() const { return mColor.hsvMax; }
+
+    // Adds or replaces a named color, throws if there are too many
+    void addColor(const std::string& name, const cv::Scalar& hsvMin, const cv::Scalar& hsvMax);
+    // False if there was no such color
+    bool removeColor(const std::string& name);
+    const std::vector<Color>& colors() const { return mColors; }
+    void setColors(const std::vector<Color>& colors);
+
+    // Regions smaller than area pixels of the processed image are ignored
+    void setMinArea(double area) { mBlobs.setMinArea(area); mTracker.setMinArea(area); }
+    double minArea() const { return mBlobs.minArea(); }
+    // Regions reported per color
+    void setMaxBlobs(size_t count) { mBlobs.setMaxBlobs(count); }
+    size_t maxBlobs() const { return mBlobs.maxBlobs(); }
+
+    // Process only a window around the tracked regions, full scan after
+    // interval windowed frames, 0 - only when a region is lost
+    void setTracking(bool tracking, int interval = 10);
+    bool tracking() const { return mTracking; }
+    int fullScanInterval() const { return mFullScanInterval; }
+    // Part of the processed image classified by the last frame, 0 to 1
+    double processedFraction() const { return mProcessedFraction; }
+
+    // Segmentation or CamShift, CamShift follows the setColor color only
+    void setMode(int mode);
+    int mode() const { return mMode; }
+    // CamShift learns the histogram of roi of the next processed image,
+    // empty roi - of the first setColor region found
+    void learnHistogram(const cv::Rect& roi = cv::Rect());
+    bool histogramLearned() const { return mTracker.learned(); }
+    // Object followed by CamShift in the processed image, angle in degrees
+    const cv::RotatedRect& trackedBox() const { return mTracker.box(); }
+
+    // Classifier of pixels, bits - RGB table bits per channel, 4 to 7
+    void setClassifier(int classifier, int bits = 5);
+    int classifier() const { return mClassifier; }
+    int tableBits() const { return mTableBits; }
+    // Whether the RGB table is built for the current colors
+    bool tableReady() const;
+
+    // Color bits of every pixel of an RGB image, unfiltered
+    void classify(const cv::Mat& rgb, cv::Mat& labels);
+
+    // Processes an RGB frame of source, id identifies the frame in
+    // FrameCache, 0 - by its content
+    void process(const cv::Mat& frame, const std::string& source, boost::uint64_t id = 0);
+
+    // Region of the setColor color
+    bool visible() const { return mResult0.visible; }
+    // Largest region center relative to the processed image center, y
+    // pointing up
+    cv::Point position() const { return mResult0.position; }
+    // All regions of the setColor color
+    const ColorResult& result0() const { return mResult0; }
+    // Regions of the named colors, in the order of colors()
+    const std::vector<ColorResult>& results() const { return mResults; }
+    // Size of the processed (downscaled) image
+    cv::Size size() const { return mResult.size(); }
+    // Grayscale image with the region in color
+    const cv::Mat& result() const { return mResult; }
+    // Unfiltered color bits of every pixel of the processed image, bit 0 -
+    // setColor color, bit i - named color i - 1. Empty in CamShift mode.
+    const cv::Mat& labels() const { return mLabels; }
+    // Image buffers allocated so far
+    boost::uint64_t allocations() const { return mScratch.allocations(); }
+    // Timing of the processing stages
+    StageTimes& times() { return mTimes; }
+
+private:
+    struct RgbTable;
+    struct TableSlot;
+
+    void updateTables();
+    // Last seen region of a color
+    struct Track {
+        Track() : valid(false) {}
+
+        bool valid;
+        cv::Rect box;
+        cv::Point2d centroid;
+        cv::Point2d velocity; // pixels per frame
+    };
+
+    void classify(const cv::Mat& rgb, cv::Mat& labels, const cv::Rect& window, BlobFinder* blobs);
+    cv::Rect searchWindow(const cv::Size& size) const;
+    void updateTracks(const cv::Rect& window, const cv::Size& size);
+    void processCamShift(const cv::Mat& rgb);
+    void drawAxes();
+    void label(const cv::Mat& hsv, cv::Mat& labels, BlobFinder* blobs) const;
+    void requestTable();
+    static void buildTable(boost::shared_ptr<TableSlot> slot, boost::uint64_t generation, int bits,
+            std::vector<uchar> tables);
+
+    double mScale;
+    Color mColor; // color of setColor
+    std::vector<Color> mColors; // named colors
+    uchar mTables[3][256]; // color bits of every H, S and V value
+    int mClassifier;
+    int mTableBits;
+    boost::shared_ptr<TableSlot> mSlot; // RGB table, shared with its builder
+    bool mTracking;
+    int mFullScanInterval;
+    int mWindowedFrames; // since the last full scan
+    bool mLost; // a tracked region was lost, scan everything
+    std::vector<Track> mTracks; // of every color, bit order
+    cv::Size mTrackSize; // processed image size of mTracks
+    cv::Rect mLabelWindow; // part of the label image written last
+    double mProcessedFraction;
+    int mMode;
+    cv::Rect mLearnRoi; // histogram of it is learned next
+    HistogramTracker mTracker;
+
+    CachedInput mInput; // resized input shared with other detectors
+    ScratchPool mScratch; // temporary images
+    BlobFinder mBlobs;
+    cv::Mat mResult;
+    cv::Mat mLabels;
+    ColorResult mResult0; // result of the setColor color
+    std::vector<ColorResult> mResults;
+    StageTimes mTimes;
+};
+
+#endif
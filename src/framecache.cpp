@@ -0,0 +1,181 @@
+/*******************************************
+ *
+ *	FrameCache
+ *   Process wide cache of images derived from an input
+ *   frame.
+ *
+ ********************************************/
+
+#include "framecache.h"
+
+#include <cstring>
+#include <stdexcept>
+
+using namespace cv;
+using namespace std;
+
+boost::uint64_t frameFingerprint(const Mat& image) {
+    // FNV-1a over 64-bit words of every row. Frames passed as images carry
+    // no ID, so all of the content is read, frames differing in a single
+    // pixel must not share derived images.
+    const boost::uint64_t prime = 1099511628211ULL;
+    boost::uint64_t hash = 14695981039346656037ULL;
+    hash = (hash ^ static_cast<boost::uint64_t>(image.rows)) * prime;
+    hash = (hash ^ static_cast<boost::uint64_t>(image.cols)) * prime;
+    hash = (hash ^ static_cast<boost::uint64_t>(image.type())) * prime;
+
+    size_t rowBytes = image.cols * image.elemSize();
+    for (int r = 0; r < image.rows; ++r) {
+        const uchar* row = image.ptr(r);
+        size_t k = 0;
+        for (; k + sizeof(boost::uint64_t) <= rowBytes; k += sizeof(boost::uint64_t)) {
+            boost::uint64_t word;
+            memcpy(&word, row + k, sizeof(word));
+            hash = (hash ^ word) * prime;
+        }
+        for (; k < rowBytes; ++k)
+            hash = (hash ^ row[k]) * prime;
+    }
+    return hash;
+}
+
+FrameCache& FrameCache::instance() {
+    static FrameCache cache;
+    return cache;
+}
+
+void FrameCache::subscribe(const string& source) {
+    boost::mutex::scoped_lock lock(mMutex);
+    ++mSources[source].subscribers;
+}
+
+void FrameCache::unsubscribe(const string& source) {
+    boost::mutex::scoped_lock lock(mMutex);
+    map<string, Source>::iterator i = mSources.find(source);
+    if (i != mSources.end() && --i->second.subscribers <= 0)
+        mSources.erase(i);
+}
+
+boost::shared_ptr<FrameCache::Entry> FrameCache::acquire(const string& source, boost::uint64_t id) {
+    boost::mutex::scoped_lock lock(mMutex);
+    Source& entries = mSources[source];
+    deque<boost::shared_ptr<Entry> >& frames = entries.frames;
+    for (size_t i = 0; i < frames.size(); ++i)
+        if (frames[i]->mId == id)
+            return frames[i];
+
+    boost::shared_ptr<Entry> entry(new Entry(id, entries.buffers));
+    frames.push_back(entry);
+    // Holders of evicted frames keep using them, the cache just forgets
+    if (frames.size() > MAX_FRAMES)
+        frames.pop_front();
+    return entry;
+}
+
+void FrameCache::release(const string& source, const boost::shared_ptr<Entry>& entry) {
+    boost::mutex::scoped_lock lock(mMutex);
+    map<string, Source>::iterator i = mSources.find(source);
+    if (i == mSources.end())
+        return;
+    if (++entry->mDone < i->second.subscribers)
+        return;
+
+    deque<boost::shared_ptr<Entry> >& frames = i->second.frames;
+    for (size_t k = 0; k < frames.size(); ++k)
+        if (frames[k] == entry) {
+            frames.erase(frames.begin() + k);
+            break;
+        }
+}
+
+Mat FrameCache::Entry::get(const Mat& frame, const Size& size, int format) {
+    // Concurrent detectors wait for the first one instead of repeating
+    // its work
+    boost::mutex::scoped_lock lock(mMutex);
+    return derive(frame, size, format);
+}
+
+Mat FrameCache::Entry::derive(const Mat& frame, const Size& size, int format) {
+    // The frame itself is never stored, it lives only as long as the caller
+    if (size == frame.size()
+            && ((format == PREPROCESS_RGB && frame.channels() == 3)
+            || (format == PREPROCESS_GRAY && frame.channels() == 1)))
+        return frame;
+
+    pair<pair<int, int>, int> key(make_pair(size.width, size.height), format);
+    map<pair<pair<int, int>, int>, Mat>::const_iterator i = mImages.find(key);
+    if (i != mImages.end()) {
+        ++FrameCache::instance().mHits;
+        return i->second;
+    }
+    ++FrameCache::instance().mMisses;
+
+    Mat result = buffer(size, format == PREPROCESS_RGB || format == PREPROCESS_GRAY_RGB ? CV_8UC3 : CV_8UC1);
+    switch (format) {
+    case PREPROCESS_RGB:
+        if (frame.channels() == 1)
+            cvtColor(derive(frame, size, PREPROCESS_GRAY), result, CV_GRAY2RGB);
+        else
+            resize(frame, result, size, 0, 0, INTER_LINEAR);
+        break;
+    case PREPROCESS_GRAY:
+        if (frame.channels() == 1)
+            resize(frame, result, size, 0, 0, INTER_LINEAR);
+        else
+            cvtColor(derive(frame, size, PREPROCESS_RGB), result, CV_RGB2GRAY);
+        break;
+    case PREPROCESS_GRAY_RGB:
+        cvtColor(derive(frame, size, PREPROCESS_GRAY), result, CV_GRAY2RGB);
+        break;
+    case PREPROCESS_EQUALIZED:
+        equalizeHist(derive(frame, size, PREPROCESS_GRAY), result);
+        break;
+    default:
+        throw runtime_error("Unknown preprocessing format");
+    }
+    mImages[key] = result;
+    return result;
+}
+
+Mat FrameCache::Entry::buffer(const Size& size, int type) {
+    // Buffers of released frames come back to the pool, and results are
+    // computed into them without allocation
+    boost::mutex::scoped_lock lock(mBuffers->mutex);
+    boost::uint64_t allocations = mBuffers->pool.allocations();
+    Mat result = mBuffers->pool.take(size, type);
+    if (mBuffers->pool.allocations() != allocations)
+        ++FrameCache::instance().mAllocations;
+    return result;
+}
+
+CachedInput::~CachedInput() {
+    end();
+    if (!mSource.empty())
+        FrameCache::instance().unsubscribe(mSource);
+}
+
+void CachedInput::begin(const string& source, const Mat& frame, boost::uint64_t id) {
+    end();
+    FrameCache& cache = FrameCache::instance();
+    if (source != mSource) {
+        if (!mSource.empty())
+            cache.unsubscribe(mSource);
+        cache.subscribe(source);
+        mSource = source;
+    }
+    mFrame = frame;
+    mEntry = cache.acquire(mSource, id != 0 ? id : frameFingerprint(frame));
+}
+
+Mat CachedInput::get(const Size& size, int format) {
+    if (!mEntry)
+        throw runtime_error("No frame to preprocess");
+    return mEntry->get(mFrame, size, format);
+}
+
+void CachedInput::end() {
+    if (mEntry)
+        FrameCache::instance().release(mSource, mEntry);
+    mEntry.reset();
+    mFrame = Mat();
+}
@@ -0,0 +1,136 @@
+/*******************************************
+ *
+ *	FrameCache
+ *   Process wide cache of images derived from an input
+ *   frame (resized, grayscale, ...). Detectors bound to the
+ *   same source compute every derived image once, the first
+ *   one to need it pays for it.
+ *
+ *   Frames are identified by source name and a frame ID,
+ *   shared memory sequence number or a content fingerprint.
+ *   A frame is evicted once every detector subscribed to its
+ *   source is done with it, or when newer frames push it
+ *   out. Buffers of evicted frames are reused by the next
+ *   ones, so a steady stream allocates nothing.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_FRAMECACHE_H
+#define URBICAMERA_FRAMECACHE_H
+
+#include <cv.h>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include "scratchpool.h"
+
+enum PreprocessFormat {
+    PREPROCESS_RGB, // resized input
+    PREPROCESS_GRAY, // resized grayscale
+    PREPROCESS_GRAY_RGB, // grayscale expanded back to three channels
+    PREPROCESS_EQUALIZED // grayscale with equalized histogram
+};
+
+// Content hash of the whole image, equal frames give equal values
+boost::uint64_t frameFingerprint(const cv::Mat& image);
+
+class FrameCache : boost::noncopyable {
+public:
+    class Entry;
+
+    static FrameCache& instance();
+
+    void subscribe(const std::string& source);
+    void unsubscribe(const std::string& source);
+
+    // Cached frame id of source, created if not seen yet
+    boost::shared_ptr<Entry> acquire(const std::string& source, boost::uint64_t id);
+    // Subscriber is done with the frame
+    void release(const std::string& source, const boost::shared_ptr<Entry>& entry);
+
+    boost::uint64_t hits() const { return mHits; }
+    boost::uint64_t misses() const { return mMisses; }
+    // Buffers allocated for derived images so far
+    boost::uint64_t allocations() const { return mAllocations; }
+
+private:
+    FrameCache() : mHits(0), mMisses(0), mAllocations(0) {}
+
+    // Frames kept per source even if some subscriber skips them
+    static const size_t MAX_FRAMES = 4;
+
+    // Buffers of derived images of one source
+    struct Buffers {
+        boost::mutex mutex;
+        ScratchPool pool;
+    };
+
+    struct Source {
+        Source() : subscribers(0), buffers(new Buffers) {}
+        int subscribers;
+        std::deque<boost::shared_ptr<Entry> > frames;
+        boost::shared_ptr<Buffers> buffers;
+    };
+
+    boost::mutex mMutex;
+    std::map<std::string, Source> mSources;
+    boost::atomic<boost::uint64_t> mHits;
+    boost::atomic<boost::uint64_t> mMisses;
+    boost::atomic<boost::uint64_t> mAllocations;
+
+    friend class Entry;
+};
+
+class FrameCache::Entry : boost::noncopyable {
+public:
+    Entry(boost::uint64_t id, const boost::shared_ptr<Buffers>& buffers) :
+            mId(id), mDone(0), mBuffers(buffers) {}
+
+    boost::uint64_t id() const { return mId; }
+
+    // Image of the given size and format derived from frame, which must be
+    // the frame this entry stands for. The result must not be modified and
+    // may share data with frame.
+    cv::Mat get(const cv::Mat& frame, const cv::Size& size, int format);
+
+private:
+    cv::Mat derive(const cv::Mat& frame, const cv::Size& size, int format);
+    cv::Mat buffer(const cv::Size& size, int type);
+
+    boost::uint64_t mId;
+    int mDone; // number of subscribers done with it, guarded by cache mutex
+    boost::shared_ptr<Buffers> mBuffers;
+    boost::mutex mMutex;
+    std::map<std::pair<std::pair<int, int>, int>, cv::Mat> mImages;
+
+    friend class FrameCache;
+};
+
+// Detector side of the cache, one per detector
+class CachedInput : boost::noncopyable {
+public:
+    CachedInput() {}
+    ~CachedInput();
+
+    // Frame about to be processed, id 0 - identify frame by its content
+    void begin(const std::string& source, const cv::Mat& frame, boost::uint64_t id = 0);
+    // Derived image of the current frame, see FrameCache::Entry::get
+    cv::Mat get(const cv::Size& size, int format);
+    // Done with the current frame
+    void end();
+
+private:
+    std::string mSource; // subscribed source
+    cv::Mat mFrame;
+    boost::shared_ptr<FrameCache::Entry> mEntry;
+};
+
+#endif
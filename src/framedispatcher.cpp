@@ -0,0 +1,116 @@
+/*******************************************
+ *
+ *	FrameDispatcher
+ *   Runs registered detectors on the same frame at once.
+ *
+ ********************************************/
+
+#include "framedispatcher.h"
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <exception>
+#include <iostream>
+#include <map>
+
+#include "workstealingpool.h"
+
+using namespace boost;
+using namespace std;
+
+FrameDispatcher& FrameDispatcher::get(const string& name) {
+    static boost::mutex registryMutex;
+    static map<string, boost::shared_ptr<FrameDispatcher> > registry;
+
+    lock_guard<boost::mutex> lock(registryMutex);
+    boost::shared_ptr<FrameDispatcher>& dispatcher = registry[name];
+    if (!dispatcher)
+        dispatcher.reset(new FrameDispatcher);
+    return *dispatcher;
+}
+
+WorkStealingPool& FrameDispatcher::pool() {
+    static WorkStealingPool pool;
+    return pool;
+}
+
+void FrameDispatcher::add(const string& detector, const Handler& handler) {
+    lock_guard<boost::mutex> lock(mDispatchMutex);
+    for (size_t i = 0; i < mHandlers.size(); ++i)
+        if (mHandlers[i].first == detector) {
+            mHandlers[i].second = handler;
+            return;
+        }
+    mHandlers.push_back(make_pair(detector, handler));
+}
+
+void FrameDispatcher::remove(const string& detector) {
+    lock_guard<boost::mutex> lock(mDispatchMutex);
+    for (size_t i = 0; i < mHandlers.size(); ++i)
+        if (mHandlers[i].first == detector) {
+            mHandlers.erase(mHandlers.begin() + i);
+            return;
+        }
+}
+
+vector<string> FrameDispatcher::detectors() {
+    lock_guard<boost::mutex> lock(mDispatchMutex);
+    vector<string> names;
+    for (size_t i = 0; i < mHandlers.size(); ++i)
+        names.push_back(mHandlers[i].first);
+    return names;
+}
+
+void FrameDispatcher::dispatch(const FrameMailbox::Frame& frame) {
+    lock_guard<boost::mutex> dispatchLock(mDispatchMutex);
+    if (mHandlers.empty())
+        return;
+
+    int64 start = cv::getTickCount();
+    {
+        lock_guard<boost::mutex> lock(mMutex);
+        mRemaining = mHandlers.size();
+        mBusy.assign(mHandlers.size(), 0);
+    }
+    for (size_t i = 0; i < mHandlers.size(); ++i)
+        pool().post(boost::bind(&FrameDispatcher::run, this, i, frame));
+
+    // Jobs refer to the handlers, never leave before they are done
+    this_thread::disable_interruption noInterruption;
+    unique_lock<boost::mutex> lock(mMutex);
+    while (mRemaining > 0)
+        mDone.wait(lock);
+
+    mMakespan = (cv::getTickCount() - start) * 1000. / cv::getTickFrequency();
+    mLastBusy.clear();
+    for (size_t i = 0; i < mHandlers.size(); ++i)
+        mLastBusy.push_back(make_pair(mHandlers[i].first, mBusy[i]));
+}
+
+void FrameDispatcher::run(size_t index, const FrameMailbox::Frame& frame) {
+    int64 start = cv::getTickCount();
+    try {
+        mHandlers[index].second(frame);
+    } catch (std::exception& e) {
+        cerr << "FrameDispatcher::run()" << endl
+                << "\t" << mHandlers[index].first << " failed: " << e.what() << endl;
+    }
+    double busy = (cv::getTickCount() - start) * 1000. / cv::getTickFrequency();
+
+    lock_guard<boost::mutex> lock(mMutex);
+    mBusy[index] = busy;
+    if (--mRemaining == 0)
+        mDone.notify_all();
+}
+
+double FrameDispatcher::makespan() {
+    lock_guard<boost::mutex> lock(mMutex);
+    return mMakespan;
+}
+
+vector<pair<string, double> > FrameDispatcher::busy() {
+    lock_guard<boost::mutex> lock(mMutex);
+    return mLastBusy;
+}
@@ -0,0 +1,68 @@
+/*******************************************
+ *
+ *	FrameDispatcher
+ *   Runs every detector registered under a dispatcher name
+ *   on the same frame at once, in a work stealing pool
+ *   shared by the whole process, and waits until all of
+ *   them are done before the next frame.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_FRAMEDISPATCHER_H
+#define URBICAMERA_FRAMEDISPATCHER_H
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "framemailbox.h"
+
+class WorkStealingPool;
+
+class FrameDispatcher : boost::noncopyable {
+public:
+    typedef boost::function<void(const FrameMailbox::Frame&)> Handler;
+
+    // Dispatcher of the given name, created on first use
+    static FrameDispatcher& get(const std::string& name);
+    // Pool shared by all dispatchers, one thread per core
+    static WorkStealingPool& pool();
+
+    // Register detector, a running frame is finished first
+    void add(const std::string& detector, const Handler& handler);
+    void remove(const std::string& detector);
+    std::vector<std::string> detectors();
+
+    // Run all handlers on frame, returns when all of them are done
+    void dispatch(const FrameMailbox::Frame& frame);
+
+    // Results of the last frame [ms]
+    double makespan();
+    std::vector<std::pair<std::string, double> > busy();
+
+private:
+    FrameDispatcher() : mRemaining(0), mMakespan(0) {}
+
+    void run(size_t, const FrameMailbox::Frame&);
+
+    // Held for a whole frame, so handlers are not removed while they run
+    boost::mutex mDispatchMutex;
+    std::vector<std::pair<std::string, Handler> > mHandlers;
+
+    // Frame in progress
+    boost::mutex mMutex;
+    boost::condition_variable mDone;
+    size_t mRemaining;
+    std::vector<double> mBusy;
+
+    // Results of the last frame
+    double mMakespan;
+    std::vector<std::pair<std::string, double> > mLastBusy;
+};
+
+#endif
@@ -0,0 +1,74 @@
+/*******************************************
+ *
+ *	FrameMailbox
+ *   Input queue between frame notifications and a
+ *   detector thread.
+ *
+ ********************************************/
+
+#include "framemailbox.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+FrameMailbox::FrameMailbox() :
+        mPolicy(MAILBOX_COALESCE), mCapacity(1), mClosed(false),
+        mReceived(0), mProcessed(0), mDropped(0) {
+}
+
+void FrameMailbox::setPolicy(int policy, size_t capacity) {
+    if (policy < MAILBOX_COALESCE || policy > MAILBOX_BLOCK)
+        throw runtime_error("Unknown input policy");
+
+    boost::mutex::scoped_lock lock(mMutex);
+    mPolicy = policy;
+    mCapacity = policy == MAILBOX_COALESCE ? 1 : max(capacity, static_cast<size_t>(1));
+    // Shrinking drops the oldest frames
+    while (mFrames.size() > mCapacity) {
+        mFrames.pop_front();
+        ++mDropped;
+    }
+    mNotFull.notify_all();
+}
+
+void FrameMailbox::post(const Frame& frame) {
+    boost::mutex::scoped_lock lock(mMutex);
+    if (mClosed)
+        return;
+    ++mReceived;
+
+    if (mPolicy == MAILBOX_BLOCK) {
+        while (mFrames.size() >= mCapacity && !mClosed)
+            mNotFull.wait(lock);
+        if (mClosed)
+            return;
+    } else if (mFrames.size() >= mCapacity) {
+        mFrames.pop_front();
+        ++mDropped;
+    }
+
+    mFrames.push_back(frame);
+    mFrames.back().tick = cv::getTickCount();
+    mNotEmpty.notify_one();
+}
+
+void FrameMailbox::take(Frame& frame) {
+    boost::mutex::scoped_lock lock(mMutex);
+    while (mFrames.empty())
+        mNotEmpty.wait(lock);
+    frame = mFrames.front();
+    mFrames.pop_front();
+    mNotFull.notify_one();
+}
+
+void FrameMailbox::done() {
+    ++mProcessed;
+}
+
+void FrameMailbox::close() {
+    boost::mutex::scoped_lock lock(mMutex);
+    mClosed = true;
+    mFrames.clear();
+    mNotFull.notify_all();
+}
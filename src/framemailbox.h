@@ -0,0 +1,75 @@
+/*******************************************
+ *
+ *	FrameMailbox
+ *   Input queue between frame notifications and a
+ *   detector thread. The policy decides what happens when
+ *   frames arrive faster than they are processed: keep only
+ *   the newest one, keep a bounded queue dropping the
+ *   oldest, or make the source wait.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_FRAMEMAILBOX_H
+#define URBICAMERA_FRAMEMAILBOX_H
+
+#include <cv.h>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <deque>
+#include <string>
+
+enum MailboxPolicy {
+    MAILBOX_COALESCE = 0, // newest frame only
+    MAILBOX_QUEUE = 1, // up to capacity frames, the oldest is dropped
+    MAILBOX_BLOCK = 2 // up to capacity frames, the source waits
+};
+
+class FrameMailbox : boost::noncopyable {
+public:
+    struct Frame {
+        Frame() : id(0), tick(0) {}
+        cv::Mat image;
+        std::string source; // for FrameCache
+        boost::uint64_t id; // for FrameCache, 0 - unknown
+        int64 tick; // time of post
+        boost::shared_ptr<void> owner; // keeps image data alive, if needed
+    };
+
+    FrameMailbox();
+
+    void setPolicy(int policy, size_t capacity);
+
+    // Producer side, waits only with MAILBOX_BLOCK
+    void post(const Frame& frame);
+    // Consumer side, waits for a frame, interruptible
+    void take(Frame& frame);
+    // Consumer finished the frame it took
+    void done();
+    // Wake up and stop waiting producers, posts are ignored from now on
+    void close();
+
+    boost::uint64_t received() const { return mReceived; }
+    boost::uint64_t processed() const { return mProcessed; }
+    boost::uint64_t dropped() const { return mDropped; }
+
+private:
+    boost::mutex mMutex;
+    boost::condition_variable mNotEmpty;
+    boost::condition_variable mNotFull;
+    std::deque<Frame> mFrames;
+    int mPolicy;
+    size_t mCapacity;
+    bool mClosed;
+
+    boost::atomic<boost::uint64_t> mReceived;
+    boost::atomic<boost::uint64_t> mProcessed;
+    boost::atomic<boost::uint64_t> mDropped;
+};
+
+#endif
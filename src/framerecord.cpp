@@ -0,0 +1,207 @@
+/*******************************************
+ *
+ *	FrameRecord
+ *   Raw recording of published frames into a preallocated
+ *   memory-mapped file and a source replaying it.
+ *
+ ********************************************/
+
+#include "framerecord.h"
+
+#include <boost/thread.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+
+using namespace boost::interprocess;
+using namespace cv;
+using namespace std;
+
+namespace framerecord {
+
+static const boost::uint32_t MAGIC = 0x55435246; // "UCRF"
+static const boost::uint32_t VERSION = 1;
+static const size_t ALIGN = 64;
+static const boost::int32_t FORMAT_RGB = 1; // urbi::IMAGE_RGB
+
+struct FileHeader {
+    boost::uint32_t magic;
+    boost::uint32_t version;
+    boost::uint32_t frames;
+    boost::uint32_t reserved;
+    boost::uint64_t used; // bytes including this header
+};
+
+struct FrameHeader {
+    boost::uint32_t seq;
+    boost::int32_t format;
+    boost::int64_t timestamp; // [us]
+    boost::int32_t width;
+    boost::int32_t height;
+    boost::int32_t type;
+    boost::uint32_t size; // bytes of data
+};
+
+static size_t aligned(size_t size) {
+    return (size + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+static size_t frameStride(size_t size) {
+    return aligned(sizeof(FrameHeader)) + aligned(size);
+}
+
+}
+
+using namespace framerecord;
+
+FrameRecorder::FrameRecorder(const string& path, size_t capacity) :
+        mPath(path), mHeader(0) {
+    capacity = max(capacity, aligned(sizeof(FileHeader)));
+
+    // Preallocate the whole file, so writing a frame never grows it
+    {
+        filebuf file;
+        if (!file.open(mPath.c_str(), ios_base::in | ios_base::out | ios_base::trunc | ios_base::binary))
+            throw runtime_error("Could not create recording " + mPath);
+        file.pubseekoff(capacity - 1, ios_base::beg);
+        file.sputc(0);
+    }
+    file_mapping(mPath.c_str(), read_write).swap(mFile);
+    mapped_region(mFile, read_write).swap(mRegion);
+
+    mHeader = new (mRegion.get_address()) FileHeader;
+    mHeader->magic = MAGIC;
+    mHeader->version = VERSION;
+    mHeader->frames = 0;
+    mHeader->reserved = 0;
+    mHeader->used = aligned(sizeof(FileHeader));
+}
+
+FrameRecorder::~FrameRecorder() {
+    mRegion.flush();
+}
+
+bool FrameRecorder::write(const Mat& frame, unsigned int seq, int64 tick, int format) {
+    size_t size = frame.total() * frame.elemSize();
+    if (mHeader->used + frameStride(size) > mRegion.get_size())
+        return false;
+
+    char* base = static_cast<char*>(mRegion.get_address()) + mHeader->used;
+    FrameHeader* header = new (base) FrameHeader;
+    header->seq = seq;
+    header->format = format;
+    header->timestamp = static_cast<boost::int64_t>(tick * 1e6 / getTickFrequency());
+    header->width = frame.cols;
+    header->height = frame.rows;
+    header->type = frame.type();
+    header->size = static_cast<boost::uint32_t>(size);
+
+    uchar* data = reinterpret_cast<uchar*>(base + aligned(sizeof(FrameHeader)));
+    if (frame.isContinuous())
+        memcpy(data, frame.data, size);
+    else
+        frame.copyTo(Mat(frame.rows, frame.cols, frame.type(), data));
+
+    // Frame counts only when complete
+    mHeader->used += frameStride(size);
+    ++mHeader->frames;
+    return true;
+}
+
+unsigned int FrameRecorder::frames() const {
+    return mHeader->frames;
+}
+
+ReplaySource::ReplaySource(const string& path, bool realTime) :
+        mRealTime(realTime), mRgb(true), mNext(0), mStartTick(0) {
+    file_mapping(path.c_str(), read_only).swap(mFile);
+    // Private mapping, a consumer writing into a served frame gets its own
+    // copy of the page instead of a crash
+    mapped_region(mFile, copy_on_write).swap(mRegion);
+
+    char* base = static_cast<char*>(mRegion.get_address());
+    const FileHeader* header = reinterpret_cast<const FileHeader*>(base);
+    if (mRegion.get_size() < sizeof(FileHeader) || header->magic != MAGIC || header->version != VERSION
+            || header->used > mRegion.get_size())
+        throw runtime_error("Not a frame recording: " + path);
+
+    // Index all frames up front, grab() is then just a pointer bump
+    size_t offset = aligned(sizeof(FileHeader));
+    for (unsigned int i = 0; i < header->frames; ++i) {
+        if (offset + aligned(sizeof(FrameHeader)) > header->used)
+            throw runtime_error("Truncated frame recording: " + path);
+        const FrameHeader* frameHeader = reinterpret_cast<const FrameHeader*>(base + offset);
+        if (offset + frameStride(frameHeader->size) > header->used)
+            throw runtime_error("Truncated frame recording: " + path);
+        // Image described by the header has to fit in its data
+        if (frameHeader->width <= 0 || frameHeader->height <= 0 || frameHeader->type < 0
+                || CV_MAT_TYPE(frameHeader->type) != frameHeader->type
+                || static_cast<boost::uint64_t>(frameHeader->width) * frameHeader->height
+                * CV_ELEM_SIZE(frameHeader->type) > frameHeader->size)
+            throw runtime_error("Truncated frame recording: " + path);
+
+        Frame frame;
+        frame.header = base + offset;
+        frame.image = Mat(frameHeader->height, frameHeader->width, frameHeader->type,
+                base + offset + aligned(sizeof(FrameHeader)));
+        mFrames.push_back(frame);
+        offset += frameStride(frameHeader->size);
+
+        // UCamera records RGB frames, anything else is passed as it is
+        if (frameHeader->format != FORMAT_RGB)
+            mRgb = false;
+    }
+    if (mFrames.empty())
+        throw runtime_error("Empty frame recording: " + path);
+}
+
+bool ReplaySource::isRecording(const string& path) {
+    ifstream file(path.c_str(), ios::binary);
+    boost::uint32_t magic = 0;
+    file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    return file && magic == MAGIC;
+}
+
+bool ReplaySource::grab() {
+    if (mNext >= mFrames.size())
+        return false;
+    if (mNext == 0)
+        mStartTick = getTickCount();
+
+    // Keep recorded spacing of frames
+    if (mRealTime) {
+        double elapsed = static_cast<double>(timestampAt(mNext) - timestampAt(0));
+        int64 due = mStartTick + static_cast<int64>(elapsed * getTickFrequency() / 1e6);
+        int64 now = getTickCount();
+        if (due > now)
+            boost::this_thread::sleep(boost::posix_time::microseconds(
+                    (due - now) * 1000000 / static_cast<int64>(getTickFrequency())));
+    }
+    ++mNext;
+    return true;
+}
+
+void ReplaySource::rewind() {
+    mNext = 0;
+}
+
+bool ReplaySource::retrieve(Mat& frame) {
+    if (mNext == 0)
+        return false;
+    frame = mFrames[mNext - 1].image;
+    return true;
+}
+
+unsigned int ReplaySource::seq() const {
+    return mNext == 0 ? 0 : reinterpret_cast<const FrameHeader*>(mFrames[mNext - 1].header)->seq;
+}
+
+boost::int64_t ReplaySource::timestamp() const {
+    return mNext == 0 ? 0 : timestampAt(mNext - 1);
+}
+
+boost::int64_t ReplaySource::timestampAt(size_t index) const {
+    return reinterpret_cast<const FrameHeader*>(mFrames[index].header)->timestamp;
+}
@@ -0,0 +1,93 @@
+/*******************************************
+ *
+ *	FrameRecord
+ *   Raw recording of published frames into a preallocated
+ *   memory-mapped file and a source replaying it. Every
+ *   frame is stored with a small header, so replayed frames
+ *   are served straight from the mapping without a copy.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_FRAMERECORD_H
+#define URBICAMERA_FRAMERECORD_H
+
+#include "framesource.h"
+
+#include <boost/cstdint.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <string>
+#include <vector>
+
+namespace framerecord {
+
+struct FileHeader;
+
+}
+
+class FrameRecorder : boost::noncopyable {
+public:
+    // Creates (or replaces) file of the given size, frames are appended
+    // until it is full
+    FrameRecorder(const std::string& path, size_t capacity);
+    ~FrameRecorder();
+
+    const std::string& path() const { return mPath; }
+
+    // Append frame captured at tick (getTickCount). Returns false if the
+    // file is full.
+    bool write(const cv::Mat& frame, unsigned int seq, int64 tick, int format);
+
+    // Number of recorded frames
+    unsigned int frames() const;
+
+private:
+    std::string mPath;
+    boost::interprocess::file_mapping mFile;
+    boost::interprocess::mapped_region mRegion;
+    framerecord::FileHeader* mHeader;
+};
+
+// Replays a recording. Frames are already oriented and keep the format
+// they were recorded in, usually RGB.
+class ReplaySource : public FrameSource {
+public:
+    // realTime - keep recorded frame timing, otherwise serve frames as
+    // fast as they are grabbed
+    ReplaySource(const std::string& path, bool realTime);
+
+    // Whether the file looks like a recording
+    static bool isRecording(const std::string& path);
+
+    virtual bool grab();
+    // frame points into the mapping and stays valid while the source lives
+    virtual bool retrieve(cv::Mat& frame);
+    virtual bool rgb() const { return mRgb; }
+    virtual void rewind();
+
+    unsigned int frames() const { return static_cast<unsigned int>(mFrames.size()); }
+
+    // Recorded sequence number and capture time [us] of the last grabbed frame
+    unsigned int seq() const;
+    boost::int64_t timestamp() const;
+
+private:
+    struct Frame {
+        const char* header;
+        cv::Mat image;
+    };
+    boost::int64_t timestampAt(size_t index) const;
+
+    boost::interprocess::file_mapping mFile;
+    boost::interprocess::mapped_region mRegion;
+    std::vector<Frame> mFrames;
+    bool mRealTime;
+    bool mRgb;
+
+    size_t mNext; // index of the next frame to grab
+    int64 mStartTick;
+};
+
+#endif
@@ -0,0 +1,215 @@
+/*******************************************
+ *
+ *	FrameRing
+ *   Preallocated ring of frame slots shared between one
+ *   producer (grab thread) and any number of readers.
+ *   Every slot is guarded by its own sequence lock, so the
+ *   producer never waits for readers and readers never hold
+ *   anything the producer needs.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_FRAMERING_H
+#define URBICAMERA_FRAMERING_H
+
+#include <cv.h>
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+class FrameRing {
+public:
+    // slots - number of frames kept, capacity - bytes reserved per frame
+    FrameRing(size_t slots, size_t capacity);
+
+    size_t capacity() const { return mCapacity; }
+
+    // Producer side. Returns Mat header placed directly over the next slot
+    // storage. Data has to be written before endWrite() is called.
+    cv::Mat beginWrite(int rows, int cols, int type);
+    // Publish the slot started by beginWrite() and wake up waiting readers.
+    // Returns sequence number of the published frame.
+    unsigned int endWrite(int64 timestamp);
+    // Same as endWrite() but with sequence number given by the caller
+    // (must be newer than the last published one).
+    unsigned int endWrite(unsigned int seq, int64 timestamp);
+    // Give up the slot started by beginWrite(). Its old frame is already
+    // overwritten, so the slot is left without a sequence number.
+    void abortWrite();
+
+    // Sequence number of the newest published frame (0 - nothing yet)
+    unsigned int latest() const { return mLatest.load(boost::memory_order_acquire); }
+
+    // Copy frame with given sequence number to dst. Returns false if that
+    // frame was already overwritten.
+    bool read(unsigned int seq, cv::Mat& dst, int64* timestamp = 0) const;
+    // Copy the newest frame to dst.
+    bool readLatest(cv::Mat& dst, unsigned int& seq, int64* timestamp = 0) const;
+
+    // Wait up to timeout for a frame newer than seq.
+    bool waitNext(unsigned int seq, const boost::posix_time::time_duration& timeout);
+
+private:
+    struct Slot {
+        Slot() : version(0), seq(0), rows(0), cols(0), type(0), timestamp(0) {}
+        boost::atomic<unsigned int> version; // odd while the slot is written
+        boost::atomic<unsigned int> seq;
+        boost::atomic<int> rows;
+        boost::atomic<int> cols;
+        boost::atomic<int> type;
+        boost::atomic<int64> timestamp;
+        std::vector<unsigned char> data;
+    };
+
+    bool readSlot(const Slot& slot, unsigned int seq, cv::Mat& dst, int64* timestamp) const;
+
+    size_t mCapacity;
+    size_t mSlotCount;
+    boost::scoped_array<Slot> mSlots;
+
+    // Producer only state
+    unsigned int mWriteSeq;
+    size_t mWriteIndex; // slot of the last published frame, independent of seq
+    Slot* mWriteSlot;
+    int mWriteRows, mWriteCols, mWriteType;
+
+    boost::atomic<unsigned int> mLatest;
+
+    // Used only to sleep readers waiting for a new frame
+    boost::atomic<int> mWaiters;
+    boost::mutex mWaitMutex;
+    boost::condition_variable mWaitCond;
+};
+
+inline FrameRing::FrameRing(size_t slots, size_t capacity) :
+        mCapacity(capacity), mSlotCount(slots > 1 ? slots : 2), mSlots(new Slot[mSlotCount]),
+        mWriteSeq(0), mWriteIndex(0), mWriteSlot(0), mWriteRows(0), mWriteCols(0), mWriteType(0),
+        mLatest(0), mWaiters(0) {
+    for (size_t i = 0; i < mSlotCount; ++i)
+        mSlots[i].data.resize(mCapacity);
+}
+
+inline cv::Mat FrameRing::beginWrite(int rows, int cols, int type) {
+    if (static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type) > mCapacity)
+        throw std::runtime_error("Frame does not fit into ring slot");
+
+    // Sequence numbers may skip, so slots go round on their own counter and
+    // the newest frame is never the one overwritten
+    mWriteSlot = &mSlots[(mWriteIndex + 1) % mSlotCount];
+    mWriteRows = rows;
+    mWriteCols = cols;
+    mWriteType = type;
+
+    // Make the slot odd, readers will reject it until endWrite()
+    mWriteSlot->version.store(mWriteSlot->version.load(boost::memory_order_relaxed) + 1,
+            boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_release);
+
+    return cv::Mat(rows, cols, type, &mWriteSlot->data[0]);
+}
+
+inline void FrameRing::abortWrite() {
+    Slot& slot = *mWriteSlot;
+    slot.seq.store(0, boost::memory_order_relaxed);
+    slot.version.store(slot.version.load(boost::memory_order_relaxed) + 1,
+            boost::memory_order_release);
+}
+
+inline unsigned int FrameRing::endWrite(int64 timestamp) {
+    return endWrite(mWriteSeq + 1, timestamp);
+}
+
+inline unsigned int FrameRing::endWrite(unsigned int seq, int64 timestamp) {
+    Slot& slot = *mWriteSlot;
+    mWriteSeq = seq;
+    mWriteIndex = (mWriteIndex + 1) % mSlotCount;
+
+    slot.seq.store(seq, boost::memory_order_relaxed);
+    slot.rows.store(mWriteRows, boost::memory_order_relaxed);
+    slot.cols.store(mWriteCols, boost::memory_order_relaxed);
+    slot.type.store(mWriteType, boost::memory_order_relaxed);
+    slot.timestamp.store(timestamp, boost::memory_order_relaxed);
+    slot.version.store(slot.version.load(boost::memory_order_relaxed) + 1,
+            boost::memory_order_release);
+
+    mLatest.store(seq);
+
+    // Take the mutex only if somebody sleeps, it is held by readers just to
+    // check the sequence number before waiting
+    if (mWaiters.load() > 0) {
+        boost::lock_guard<boost::mutex> lock(mWaitMutex);
+        mWaitCond.notify_all();
+    }
+    return seq;
+}
+
+inline bool FrameRing::readSlot(const Slot& slot, unsigned int seq, cv::Mat& dst, int64* timestamp) const {
+    unsigned int before = slot.version.load(boost::memory_order_acquire);
+    if (before & 1)
+        return false;
+    if (slot.seq.load(boost::memory_order_relaxed) != seq)
+        return false;
+
+    int rows = slot.rows.load(boost::memory_order_relaxed);
+    int cols = slot.cols.load(boost::memory_order_relaxed);
+    int type = slot.type.load(boost::memory_order_relaxed);
+    int64 stamp = slot.timestamp.load(boost::memory_order_relaxed);
+    size_t size = static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type);
+    if (size > mCapacity)
+        return false;
+
+    dst.create(rows, cols, type);
+    std::memcpy(dst.data, &slot.data[0], size);
+
+    boost::atomic_thread_fence(boost::memory_order_acquire);
+    if (slot.version.load(boost::memory_order_relaxed) != before)
+        return false;
+
+    if (timestamp)
+        *timestamp = stamp;
+    return true;
+}
+
+inline bool FrameRing::read(unsigned int seq, cv::Mat& dst, int64* timestamp) const {
+    if (seq == 0)
+        return false;
+    // Sequence numbers given to endWrite() may skip, so look at every slot
+    for (size_t i = 0; i < mSlotCount; ++i)
+        if (mSlots[i].seq.load(boost::memory_order_relaxed) == seq)
+            return readSlot(mSlots[i], seq, dst, timestamp);
+    return false;
+}
+
+inline bool FrameRing::readLatest(cv::Mat& dst, unsigned int& seq, int64* timestamp) const {
+    // Producer can lap a slow reader, in such case simply try again with a
+    // newer frame
+    for (size_t attempt = 0; attempt < mSlotCount; ++attempt) {
+        unsigned int last = latest();
+        if (read(last, dst, timestamp)) {
+            seq = last;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool FrameRing::waitNext(unsigned int seq, const boost::posix_time::time_duration& timeout) {
+    if (latest() != seq)
+        return true;
+
+    boost::unique_lock<boost::mutex> lock(mWaitMutex);
+    ++mWaiters;
+    boost::system_time deadline = boost::get_system_time() + timeout;
+    while (latest() == seq)
+        if (!mWaitCond.timed_wait(lock, deadline))
+            break;
+    --mWaiters;
+    return latest() != seq;
+}
+
+#endif
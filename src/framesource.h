@@ -0,0 +1,50 @@
+/*******************************************
+ *
+ *	FrameSource
+ *   Common interface of everything UCamera can grab
+ *   frames from. grab() is expected to be cheap, retrieve()
+ *   decodes the last grabbed frame as a BGR image
+ *   (RGB if rgb() says so).
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_FRAMESOURCE_H
+#define URBICAMERA_FRAMESOURCE_H
+
+#include <cv.h>
+#include <highgui.h>
+
+#include <string>
+
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    virtual bool grab() = 0;
+    virtual bool retrieve(cv::Mat& frame) = 0;
+    virtual void release() {}
+    // Next grab() gives the first frame again, live sources ignore it
+    virtual void rewind() {}
+    // retrieve() gives RGB instead of BGR frames
+    virtual bool rgb() const { return false; }
+};
+
+// Frames from a camera device (or a video file) opened by OpenCV
+class CaptureSource : public FrameSource {
+public:
+    explicit CaptureSource(int id) { mCapture.open(id); }
+    explicit CaptureSource(const std::string& file) { mCapture.open(file); }
+
+    bool isOpened() const { return mCapture.isOpened(); }
+    // Position of the last grabbed frame in a video file [s]
+    double position() { return mCapture.get(CV_CAP_PROP_POS_MSEC) / 1000.; }
+
+    virtual bool grab() { return mCapture.grab(); }
+    virtual bool retrieve(cv::Mat& frame) { return mCapture.retrieve(frame); }
+    virtual void release() { mCapture.release(); }
+
+private:
+    cv::VideoCapture mCapture;
+};
+
+#endif
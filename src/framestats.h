@@ -0,0 +1,108 @@
+/*******************************************
+ *
+ *	FrameStats
+ *   Capture pipeline counters and latency histogram.
+ *   Everything is kept in atomics, so the grab thread and
+ *   readers record without taking any lock.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_FRAMESTATS_H
+#define URBICAMERA_FRAMESTATS_H
+
+#include <cv.h>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+class FrameStats : boost::noncopyable {
+public:
+    FrameStats() { reset(); }
+
+    void reset() {
+        mCaptured = 0;
+        mPublished = 0;
+        mDelivered = 0;
+        mDropped = 0;
+        for (size_t i = 0; i < BUCKETS; ++i)
+            mLatency[i] = 0;
+        mStartTick = getTickCount();
+    }
+
+    // Grab thread
+    void captured() { mCaptured.fetch_add(1, boost::memory_order_relaxed); }
+    void published() { mPublished.fetch_add(1, boost::memory_order_relaxed); }
+
+    // Reader handed out a frame captured at captureTick, skipping frames
+    // it has never seen
+    void delivered(unsigned int skipped, int64 captureTick) {
+        mDelivered.fetch_add(1, boost::memory_order_relaxed);
+        mDropped.fetch_add(skipped, boost::memory_order_relaxed);
+        int64 ticks = getTickCount() - captureTick;
+        boost::uint64_t us = ticks > 0 ? static_cast<boost::uint64_t>(ticks * 1e6 / getTickFrequency()) : 0;
+        mLatency[bucket(us)].fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    boost::uint64_t capturedCount() const { return mCaptured.load(boost::memory_order_relaxed); }
+    boost::uint64_t publishedCount() const { return mPublished.load(boost::memory_order_relaxed); }
+    boost::uint64_t deliveredCount() const { return mDelivered.load(boost::memory_order_relaxed); }
+    boost::uint64_t droppedCount() const { return mDropped.load(boost::memory_order_relaxed); }
+
+    // Captured frames per second since the last reset
+    double captureFps() const {
+        double seconds = (getTickCount() - mStartTick.load()) / getTickFrequency();
+        return seconds > 0 ? capturedCount() / seconds : 0;
+    }
+
+    // Capture to delivery latency [ms] below which fraction of frames fall
+    double latencyPercentile(double fraction) const {
+        boost::uint64_t counts[BUCKETS], total = 0;
+        for (size_t i = 0; i < BUCKETS; ++i)
+            total += counts[i] = mLatency[i].load(boost::memory_order_relaxed);
+        if (total == 0)
+            return 0;
+
+        boost::uint64_t rank = static_cast<boost::uint64_t>(fraction * (total - 1)), seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen > rank)
+                return bucketValue(i) / 1000.;
+        }
+        return bucketValue(BUCKETS - 1) / 1000.;
+    }
+
+private:
+    // Four buckets per power of two of microseconds, that is at most 19%
+    // error over the whole range
+    static const size_t BUCKETS = 4 * 40;
+
+    static size_t bucket(boost::uint64_t us) {
+        if (us < 4)
+            return static_cast<size_t>(us);
+        size_t exponent = 0;
+        while ((us >> exponent) >= 8)
+            ++exponent;
+        // us >> exponent is 4..7 here
+        size_t index = 4 * (exponent + 1) + static_cast<size_t>((us >> exponent) - 4);
+        return index < BUCKETS ? index : BUCKETS - 1;
+    }
+
+    // Middle of the bucket [us]
+    static double bucketValue(size_t index) {
+        if (index < 4)
+            return static_cast<double>(index);
+        size_t exponent = index / 4 - 1;
+        double low = static_cast<double>(static_cast<boost::uint64_t>(4 + index % 4) << exponent);
+        return low + static_cast<double>(static_cast<boost::uint64_t>(1) << exponent) / 2.;
+    }
+
+    boost::atomic<boost::uint64_t> mCaptured;
+    boost::atomic<boost::uint64_t> mPublished;
+    boost::atomic<boost::uint64_t> mDelivered;
+    boost::atomic<boost::uint64_t> mDropped;
+    boost::atomic<boost::uint64_t> mLatency[BUCKETS];
+    boost::atomic<int64> mStartTick;
+};
+
+#endif
@@ -0,0 +1,97 @@
+/*******************************************
+ *
+ *	HistogramTracker
+ *   CamShift tracking of a hue/saturation histogram.
+ *
+ ********************************************/
+
+#include "histogramtracker.h"
+
+#include <algorithm>
+
+using namespace cv;
+using namespace std;
+
+// Histogram of hue and saturation
+static const int CHANNELS[] = {0, 1};
+static const int BINS[] = {30, 32};
+static const float HUE_RANGE[] = {0, 180};
+static const float SATURATION_RANGE[] = {0, 256};
+static const float* RANGES[] = {HUE_RANGE, SATURATION_RANGE};
+
+// Hue of dark and gray pixels is noise
+static const int MIN_SATURATION = 30;
+static const int MIN_VALUE = 10;
+
+HistogramTracker::HistogramTracker() : mMinArea(50), mProcessedFraction(0) {
+}
+
+void HistogramTracker::mask(const Mat& hsv, Mat& mask) const {
+    inRange(hsv, Scalar(0, MIN_SATURATION, MIN_VALUE, 0), Scalar(180, 256, 256, 0), mask);
+}
+
+void HistogramTracker::learn(const Mat& rgb, const Rect& roi, const Mat& objectMask) {
+    Rect window = roi & Rect(0, 0, rgb.cols, rgb.rows);
+    if (window.area() == 0) {
+        reset();
+        return;
+    }
+
+    Mat hsv, valid;
+    cvtColor(rgb(window), hsv, CV_RGB2HSV);
+    mask(hsv, valid);
+    if (!objectMask.empty())
+        bitwise_and(valid, objectMask, valid);
+    calcHist(&hsv, 1, CHANNELS, valid, mHistogram, 2, BINS, RANGES);
+    normalize(mHistogram, mHistogram, 0, 255, NORM_MINMAX);
+    mWindow = window;
+}
+
+void HistogramTracker::reset() {
+    mHistogram = MatND();
+    mWindow = Rect();
+}
+
+bool HistogramTracker::track(const Mat& rgb, StageTimes& times) {
+    // Object moves at most about half its size between frames, the whole
+    // image is searched once it is lost
+    Rect full(0, 0, rgb.cols, rgb.rows);
+    Rect search = full;
+    if (mWindow.area() > 0) {
+        int margin = max(mWindow.width, mWindow.height) / 2 + 16;
+        search = Rect(mWindow.x - margin, mWindow.y - margin,
+                mWindow.width + 2 * margin, mWindow.height + 2 * margin) & full;
+    }
+    mProcessedFraction = static_cast<double>(search.area()) / full.area();
+
+    // Buffers stay full size, windows of them do not reallocate
+    Mat hsv = mScratch.get(0, full.size(), CV_8UC3)(search);
+    Mat valid = mScratch.get(1, full.size(), CV_8UC1)(search);
+    Mat backProjection = mScratch.get(2, full.size(), CV_8UC1)(search);
+    {
+        ScopedStage stage(times, STAGE_CONVERT);
+        cvtColor(rgb(search), hsv, CV_RGB2HSV);
+    }
+    {
+        ScopedStage stage(times, STAGE_THRESHOLD);
+        calcBackProject(&hsv, 1, CHANNELS, mHistogram, backProjection, RANGES);
+        mask(hsv, valid);
+        bitwise_and(backProjection, valid, backProjection);
+    }
+
+    ScopedStage stage(times, STAGE_DETECT);
+    Rect window = mWindow.area() > 0 ? Rect(mWindow.x - search.x, mWindow.y - search.y,
+            mWindow.width, mWindow.height) : Rect(0, 0, search.width, search.height);
+    mBox = CamShift(backProjection, window, TermCriteria(TermCriteria::COUNT | TermCriteria::EPS, 10, 1));
+    window &= Rect(0, 0, search.width, search.height);
+
+    // Back projection is 255 for the most likely color
+    if (window.area() == 0 || sum(backProjection(window))[0] / 255 < mMinArea) {
+        mWindow = Rect();
+        return false;
+    }
+    mWindow = Rect(window.x + search.x, window.y + search.y, window.width, window.height);
+    mBox.center.x += search.x;
+    mBox.center.y += search.y;
+    return true;
+}
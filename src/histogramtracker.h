@@ -0,0 +1,55 @@
+/*******************************************
+ *
+ *	HistogramTracker
+ *   Follows a colored object by the hue/saturation
+ *   histogram learned from it, CamShift over the back
+ *   projection of a window around the last position.
+ *   Only the window is converted and back projected, the
+ *   whole image only when the object is lost.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_HISTOGRAMTRACKER_H
+#define URBICAMERA_HISTOGRAMTRACKER_H
+
+#include <cv.h>
+
+#include <boost/noncopyable.hpp>
+
+#include "scratchpool.h"
+#include "stagetimer.h"
+
+class HistogramTracker : boost::noncopyable {
+public:
+    HistogramTracker();
+
+    // Learns the histogram of the pixels of roi of an RGB image, only those
+    // set in mask if it is not empty (mask is of roi size). Tracking starts
+    // at roi.
+    void learn(const cv::Mat& rgb, const cv::Rect& roi, const cv::Mat& mask = cv::Mat());
+    bool learned() const { return !mHistogram.empty(); }
+    void reset();
+
+    // Regions with less back projected pixels than area are lost
+    void setMinArea(double area) { mMinArea = area; }
+
+    // Follows the object in the next RGB image, false if it is lost
+    bool track(const cv::Mat& rgb, StageTimes& times);
+
+    // Object found by the last track, angle in degrees
+    const cv::RotatedRect& box() const { return mBox; }
+    // Part of the image the last track looked at, 0 to 1
+    double processedFraction() const { return mProcessedFraction; }
+
+private:
+    void mask(const cv::Mat& hsv, cv::Mat& mask) const;
+
+    cv::MatND mHistogram;
+    cv::Rect mWindow; // CamShift window, empty - lost
+    cv::RotatedRect mBox;
+    double mMinArea;
+    double mProcessedFraction;
+    ScratchPool mScratch;
+};
+
+#endif
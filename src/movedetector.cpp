@@ -0,0 +1,129 @@
+/*******************************************
+ *
+ *	MoveDetector
+ *   Motion history based movement detection.
+ *
+ ********************************************/
+
+#include "movedetector.h"
+
+using namespace cv;
+using namespace std;
+
+MoveDetector::MoveDetector() :
+        mScale(1), mDuration(1), mDiffThreshold(30), mSmooth(31), mImageBuffer(2),
+        mVisible(false) {
+}
+
+void MoveDetector::setScale(double scale) {
+    scale = scale > 1.0 ? scale : 1.0;
+    if (scale != mScale)
+        reset();
+    mScale = scale;
+}
+
+void MoveDetector::setBufferSize(int frames) {
+    frames = frames > 0 ? frames : 1;
+    if (static_cast<size_t>(frames) == mImageBuffer.capacity())
+        return;
+    mImageBuffer.set_capacity(frames);
+    reset();
+}
+
+void MoveDetector::reset() {
+    mImageBuffer.clear();
+}
+
+bool MoveDetector::process(const Mat& frame, const string& source, boost::uint64_t id, double timestamp) {
+    mInput.begin(source, frame, id);
+
+    //Resize image, skipped if the source is already downscaled
+    mSize = Size(cvRound(frame.cols / mScale), cvRound(frame.rows / mScale));
+    if (mSize != mMHI.size()) {
+        mMHI = Mat::zeros(mSize, CV_32F);
+        reset();
+    }
+
+    // Copy image to mResult as grayscaled image. Cached images are never
+    // modified, so they can be kept in the buffer, the source frame has to
+    // be copied, into a buffer of one of the frames that left the buffer.
+    Mat grayscaleImage;
+    {
+        ScopedStage stage(mTimes, STAGE_RESIZE);
+        grayscaleImage = mInput.get(mSize, PREPROCESS_GRAY);
+        if (grayscaleImage.data == frame.data) {
+            Mat copy = mScratch.take(mSize, CV_8UC1);
+            grayscaleImage.copyTo(copy);
+            grayscaleImage = copy;
+        }
+    }
+    {
+        ScopedStage stage(mTimes, STAGE_CONVERT);
+        mInput.get(mSize, PREPROCESS_GRAY_RGB).copyTo(mResult);
+    }
+    mInput.end();
+    mImageBuffer.push_back(grayscaleImage);
+
+    if (!mImageBuffer.full())
+        return false;
+
+    if (timestamp < 0)
+        timestamp = static_cast<double>(getTickCount()) / getTickFrequency();
+
+    Mat& silh = mScratch.get(0, mSize, CV_8UC1);
+    {
+        ScopedStage stage(mTimes, STAGE_THRESHOLD);
+        absdiff(mImageBuffer.front(), mImageBuffer.back(), silh);
+        threshold(silh, silh, mDiffThreshold, 1, CV_THRESH_BINARY);
+    }
+
+    Mat& historyImage = mScratch.get(1, mSize, CV_8UC1);
+    {
+        ScopedStage stage(mTimes, STAGE_MOTION);
+        updateMotionHistory(silh, mMHI, timestamp, mDuration);
+        mMHI.convertTo(historyImage, CV_8U, 255. / mDuration,
+                (mDuration - timestamp) * 255. / mDuration);
+        threshold(historyImage, historyImage, 1, 255, CV_THRESH_BINARY);
+    }
+
+    // Median blur cannot work in place without a hidden copy
+    Mat& thresholdImage = mScratch.get(2, mSize, CV_8UC1);
+    {
+        ScopedStage stage(mTimes, STAGE_FILTER);
+        medianBlur(historyImage, thresholdImage, mSmooth);
+    }
+
+    // Compute center of the position
+    cv::Moments computedMoments;
+    {
+        ScopedStage stage(mTimes, STAGE_MOMENTS);
+        computedMoments = moments(thresholdImage);
+    }
+    int xx = static_cast<int>(computedMoments.m10 / computedMoments.m00);
+    int yy = static_cast<int>(computedMoments.m01 / computedMoments.m00);
+
+    ScopedStage stage(mTimes, STAGE_DRAW);
+    Mat& greenImage = mScratch.get(3, mSize, CV_8UC3);
+    greenImage.setTo(Scalar(255, 0, 0));
+    add(greenImage, mResult, mResult, thresholdImage);
+
+    // Finally set visible
+    if ((xx > 0) && (yy > 0)) {
+        mPosition = Point(xx - frame.cols / 2, -yy + frame.rows / 2);
+        mVisible = true;
+
+        // Draw line from image center to object center
+        line(mResult, Point(xx, yy), Point(mResult.cols / 2, mResult.rows / 2),
+                Scalar(255, 0, 0), 2);
+    } else {
+        mPosition = Point(0, 0);
+        mVisible = false;
+    }
+
+    // Draw horizontal and vertical line in the middle of the image
+    line(mResult, Point(0, mResult.rows / 2), Point(mResult.cols, mResult.rows / 2),
+            Scalar(100, 100, 100), 1);
+    line(mResult, Point(mResult.cols / 2, 0), Point(mResult.cols / 2, mResult.rows),
+            Scalar(100, 100, 100), 1);
+    return true;
+}
@@ -0,0 +1,83 @@
+/*******************************************
+ *
+ *	MoveDetector
+ *   Motion history based movement detection, image
+ *   processing of UMoveDetector without the Urbi side, so
+ *   it can be run and profiled offline.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_MOVEDETECTOR_H
+#define URBICAMERA_MOVEDETECTOR_H
+
+#include <cv.h>
+
+#include <boost/circular_buffer.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <string>
+
+#include "framecache.h"
+#include "scratchpool.h"
+#include "stagetimer.h"
+
+class MoveDetector : boost::noncopyable {
+public:
+    MoveDetector();
+
+    // Frames are downscaled by scale before processing, at least 1.
+    // Changing it restarts the detection.
+    void setScale(double scale);
+    double scale() const { return mScale; }
+    // Number of frames between the compared ones plus one, at least 1.
+    // Changing it restarts the detection.
+    void setBufferSize(int frames);
+    int bufferSize() const { return static_cast<int>(mImageBuffer.capacity()); }
+    // Time window of the motion history in seconds
+    void setDuration(double duration) { mDuration = duration; }
+    // Difference between compared frames taken as movement
+    void setDiffThreshold(double threshold) { mDiffThreshold = threshold; }
+    // Median filter aperture, odd
+    void setSmooth(int smooth) { mSmooth = smooth; }
+
+    // Forgets buffered frames
+    void reset();
+
+    // Processes an RGB or grayscale frame of source, id identifies the frame
+    // in FrameCache, 0 - by its content. timestamp [s] places the frame in
+    // the motion history, negative - now. Returns false while the frame
+    // buffer fills, results are not updated then.
+    bool process(const cv::Mat& frame, const std::string& source, boost::uint64_t id = 0,
+            double timestamp = -1);
+
+    bool visible() const { return mVisible; }
+    // Movement center relative to the frame center, y pointing up
+    cv::Point position() const { return mPosition; }
+    // Size of the processed (downscaled) image
+    cv::Size size() const { return mSize; }
+    // Grayscale image with the movement in color
+    const cv::Mat& result() const { return mResult; }
+    // Image buffers allocated so far
+    boost::uint64_t allocations() const { return mScratch.allocations(); }
+    // Timing of the processing stages
+    StageTimes& times() { return mTimes; }
+
+private:
+    double mScale;
+    double mDuration;
+    double mDiffThreshold;
+    int mSmooth;
+
+    CachedInput mInput; // resized and grayscale input shared with other detectors
+    ScratchPool mScratch; // temporary images and copies in mImageBuffer
+    boost::circular_buffer<cv::Mat> mImageBuffer;
+    cv::Mat mMHI;
+    cv::Size mSize;
+    cv::Mat mResult;
+    bool mVisible;
+    cv::Point mPosition;
+    StageTimes mTimes;
+};
+
+#endif
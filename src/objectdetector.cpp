@@ -0,0 +1,187 @@
+/*******************************************
+ *
+ *	ObjectDetector
+ *   Haar cascade detection.
+ *
+ ********************************************/
+
+#include "objectdetector.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace cv;
+using namespace std;
+
+// Corners followed per object
+static const int MAX_POINTS = 30;
+// Objects are lost when fewer of their points follow them
+static const int MIN_POINTS = 5;
+static const double MIN_CONFIDENCE = 0.5;
+// Forward-backward flow error of a point that followed, in pixels
+static const double MAX_FLOW_ERROR = 1.0;
+
+ObjectDetector::ObjectDetector() : mScale(1), mTracking(false), mInterval(10), mTrackedFrames(0),
+        mDetected(false), mRedetectionRate(1), mFrameTime(0), mConfidence(0) {
+}
+
+bool ObjectDetector::load(const string& cascade) {
+    return mCascade.load(cascade);
+}
+
+void ObjectDetector::setScale(double scale) {
+    mScale = scale > 1.0 ? scale : 1.0;
+}
+
+void ObjectDetector::setTracking(bool tracking, int interval) {
+    mTracking = tracking;
+    mInterval = interval > 0 ? interval : 0;
+    if (!mTracking)
+        mPrevious = Mat();
+}
+
+double ObjectDetector::median(vector<double>& values) {
+    vector<double>::iterator middle = values.begin() + values.size() / 2;
+    nth_element(values.begin(), middle, values.end());
+    return *middle;
+}
+
+bool ObjectDetector::trackObjects(const Mat& gray) {
+    if (mPrevious.size() != gray.size())
+        return false;
+
+    // Corners of the previous boxes, found again every frame so they stay
+    // on the object
+    mPoints.clear();
+    mFirst.clear();
+    for (size_t i = 0; i < mObjects.size(); ++i) {
+        const Rect& box = mObjects[i];
+        mFirst.push_back(mPoints.size());
+        goodFeaturesToTrack(mPrevious(box), mCorners, MAX_POINTS, 0.01, max(3, box.width / 10));
+        for (size_t k = 0; k < mCorners.size(); ++k)
+            mPoints.push_back(Point2f(mCorners[k].x + box.x, mCorners[k].y + box.y));
+    }
+    mFirst.push_back(mPoints.size());
+    if (mPoints.empty())
+        return false;
+
+    // Points that do not come back where they started did not follow
+    calcOpticalFlowPyrLK(mPrevious, gray, mPoints, mNext, mStatus, mErrors, Size(15, 15), 2);
+    calcOpticalFlowPyrLK(gray, mPrevious, mNext, mBack, mBackStatus, mErrors, Size(15, 15), 2);
+
+    // Boxes move by the median motion of their points and scale by the
+    // median change of the distances between them
+    Rect image(0, 0, gray.cols, gray.rows);
+    mConfidence = 1;
+    for (size_t i = 0; i < mObjects.size(); ++i) {
+        mGood.clear();
+        for (size_t k = mFirst[i]; k < mFirst[i + 1]; ++k) {
+            double dx = mBack[k].x - mPoints[k].x;
+            double dy = mBack[k].y - mPoints[k].y;
+            if (mStatus[k] && mBackStatus[k] && dx * dx + dy * dy <= MAX_FLOW_ERROR * MAX_FLOW_ERROR)
+                mGood.push_back(k);
+        }
+        double confidence = mFirst[i + 1] > mFirst[i]
+                ? static_cast<double>(mGood.size()) / (mFirst[i + 1] - mFirst[i]) : 0;
+        mConfidence = min(mConfidence, confidence);
+        if (mGood.size() < static_cast<size_t>(MIN_POINTS) || confidence < MIN_CONFIDENCE)
+            return false;
+
+        mDx.clear();
+        mDy.clear();
+        mRatios.clear();
+        for (size_t a = 0; a < mGood.size(); ++a) {
+            const Point2f& from = mPoints[mGood[a]];
+            const Point2f& to = mNext[mGood[a]];
+            mDx.push_back(to.x - from.x);
+            mDy.push_back(to.y - from.y);
+            for (size_t b = a + 1; b < mGood.size(); ++b) {
+                const Point2f& from2 = mPoints[mGood[b]];
+                const Point2f& to2 = mNext[mGood[b]];
+                double before = norm(from2 - from);
+                if (before > 1)
+                    mRatios.push_back(norm(to2 - to) / before);
+            }
+        }
+        double scale = mRatios.empty() ? 1 : median(mRatios);
+        Rect& box = mObjects[i];
+        double cx = box.x + box.width / 2. + median(mDx);
+        double cy = box.y + box.height / 2. + median(mDy);
+        double width = box.width * scale;
+        double height = box.height * scale;
+        box = Rect(cvRound(cx - width / 2), cvRound(cy - height / 2), cvRound(width), cvRound(height)) & image;
+        // Object left the image
+        if (box.width < 8 || box.height < 8)
+            return false;
+    }
+    return true;
+}
+
+void ObjectDetector::process(const Mat& frame, const string& source, boost::uint64_t id) {
+    if (mCascade.empty())
+        throw runtime_error("Cascade classifier not loaded");
+
+    int64 start = getTickCount();
+    mInput.begin(source, frame, id);
+
+    // Resize image, skipped if the source is already downscaled or another
+    // detector has already done it. Grayscale source does not need color
+    // conversion.
+    Size size(cvRound(frame.cols / mScale), cvRound(frame.rows / mScale));
+    Mat smallImage;
+    {
+        ScopedStage stage(mTimes, STAGE_RESIZE);
+        smallImage = mInput.get(size, PREPROCESS_EQUALIZED);
+    }
+    {
+        ScopedStage stage(mTimes, STAGE_CONVERT);
+        mInput.get(size, frame.channels() == 1 ? PREPROCESS_GRAY_RGB : PREPROCESS_RGB).copyTo(mResult);
+    }
+
+    // Cascade runs when there is nothing to track, periodically to correct
+    // the drift and find new objects, and when tracking fails
+    mDetected = !mTracking || mObjects.empty() || mTrackedFrames >= mInterval;
+    if (!mDetected) {
+        ScopedStage stage(mTimes, STAGE_MOTION);
+        mDetected = !trackObjects(smallImage);
+    }
+    if (mDetected) {
+        ScopedStage stage(mTimes, STAGE_DETECT);
+        mCascade.detectMultiScale(smallImage, mObjects, 1.1, 2, Size(30, 30));
+        mTrackedFrames = 0;
+    } else {
+        ++mTrackedFrames;
+    }
+    // Cached images are not modified, keeping a reference is enough
+    if (mTracking)
+        mPrevious = smallImage;
+    mRedetectionRate = 0.95 * mRedetectionRate + 0.05 * (mDetected ? 1 : 0);
+    mInput.end();
+
+    ScopedStage stage(mTimes, STAGE_DRAW);
+
+    if (!mObjects.empty()) {
+        vector<Rect>::const_iterator biggest = mObjects.begin();
+        for (vector<Rect>::const_iterator i = mObjects.begin(); i < mObjects.end(); ++i) {
+            if (i->area() > biggest->area())
+                biggest = i;
+        }
+
+        // Draw on a mResult
+        Point center(biggest->x+biggest->width/2, biggest->y+biggest->height/2);
+        int radius = (biggest->height + biggest->height)/4;
+        circle(mResult, center, radius, Scalar(255,0,0), 3, 8, 0);
+        line(mResult, center, Point(mResult.cols/2, mResult.rows/2), Scalar(255, 0, 0), 2);
+
+        mPosition = Point(biggest->x-mResult.cols/2, -biggest->y-mResult.rows/2);
+    } else {
+        mPosition = Point(0, 0);
+    }
+
+    // Draw horizontal and vertical line in the middle of the image
+    line(mResult, Point(0, mResult.rows/2), Point(mResult.cols, mResult.rows/2), Scalar(100, 100, 100), 1);
+    line(mResult, Point(mResult.cols/2, 0), Point(mResult.cols/2, mResult.rows), Scalar(100, 100, 100), 1);
+
+    double time = (getTickCount() - start) * 1000. / getTickFrequency();
+    mFrameTime = mFrameTime > 0 ? 0.95 * mFrameTime + 0.05 * time : time;
+}
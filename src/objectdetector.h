@@ -0,0 +1,114 @@
+/*******************************************
+ *
+ *	ObjectDetector
+ *   Haar cascade detection, image processing of
+ *   UObjectDetector without the Urbi side, so it can be run
+ *   and profiled offline.
+ *
+ *   In tracking mode the cascade runs only every few
+ *   frames, or when tracking confidence drops. In between
+ *   the objects are followed by pyramidal Lucas-Kanade flow
+ *   of corners inside their boxes, checked forward and
+ *   backward.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_OBJECTDETECTOR_H
+#define URBICAMERA_OBJECTDETECTOR_H
+
+#include <cv.h>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <string>
+#include <vector>
+
+#include "framecache.h"
+#include "parallelcascade.h"
+#include "stagetimer.h"
+
+class ObjectDetector : boost::noncopyable {
+public:
+    ObjectDetector();
+
+    // Loads the cascade classifier, false on failure
+    bool load(const std::string& cascade);
+    bool empty() const { return mCascade.empty(); }
+
+    // Threads running the cascade, 0 - one per core, see ParallelCascade
+    void setThreads(size_t threads) { mCascade.setThreads(threads); }
+    size_t threads() const { return mCascade.threads(); }
+
+    // Frames are downscaled by scale before processing, at least 1
+    void setScale(double scale);
+    double scale() const { return mScale; }
+
+    // Objects are tracked between cascade runs, interval - tracked frames
+    // between cascade runs
+    void setTracking(bool tracking, int interval = 10);
+    bool tracking() const { return mTracking; }
+    int detectInterval() const { return mInterval; }
+
+    // Processes an RGB or grayscale frame of source, id identifies the frame
+    // in FrameCache, 0 - by its content
+    void process(const cv::Mat& frame, const std::string& source, boost::uint64_t id = 0);
+
+    // Objects found on the processed image
+    const std::vector<cv::Rect>& objects() const { return mObjects; }
+    bool visible() const { return !mObjects.empty(); }
+    // Position of the biggest object relative to the image center
+    cv::Point position() const { return mPosition; }
+    // Size of the processed (downscaled) image
+    cv::Size size() const { return mResult.size(); }
+    // Input image with the biggest object marked
+    const cv::Mat& result() const { return mResult; }
+    // Whether the last frame ran the cascade
+    bool detected() const { return mDetected; }
+    // Average part of frames running the cascade, 0 to 1
+    double redetectionRate() const { return mRedetectionRate; }
+    // Average processing time of a frame in ms
+    double frameTime() const { return mFrameTime; }
+    // Part of the points that followed the worst tracked object, of the
+    // last frame that tracked
+    double confidence() const { return mConfidence; }
+    // Timing of the processing stages
+    StageTimes& times() { return mTimes; }
+
+private:
+    bool trackObjects(const cv::Mat& gray);
+    static double median(std::vector<double>& values);
+
+    ParallelCascade mCascade;
+    double mScale;
+
+    CachedInput mInput; // resized and equalized input shared with other detectors
+    std::vector<cv::Rect> mObjects; // keeps its capacity between frames
+    cv::Mat mResult;
+    cv::Point mPosition;
+    StageTimes mTimes;
+
+    bool mTracking;
+    int mInterval;
+    int mTrackedFrames; // since the last cascade run
+    bool mDetected;
+    double mRedetectionRate;
+    double mFrameTime;
+    double mConfidence;
+    cv::Mat mPrevious; // equalized image of the previous frame, from FrameCache
+    // Flow scratch, kept between frames
+    std::vector<cv::Point2f> mCorners;
+    std::vector<cv::Point2f> mPoints;
+    std::vector<size_t> mFirst; // first point of every object in mPoints
+    std::vector<cv::Point2f> mNext;
+    std::vector<cv::Point2f> mBack;
+    std::vector<uchar> mStatus;
+    std::vector<uchar> mBackStatus;
+    std::vector<float> mErrors;
+    std::vector<double> mDx;
+    std::vector<double> mDy;
+    std::vector<double> mRatios;
+    std::vector<size_t> mGood;
+};
+
+#endif
@@ -0,0 +1,311 @@
+/*******************************************
+ *
+ *	Orientation
+ *   Fused rotation and BGR<->RGB swap of 8-bit three
+ *   channel images.
+ *
+ ********************************************/
+
+#include "orientation.h"
+
+#include <algorithm>
+#include <cstring>
+
+// SSSE3 code is compiled for its own target and chosen at run time, so the
+// binary still runs on x86 CPUs without it
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(ORIENT_NO_SSSE3) \
+        && (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#include <tmmintrin.h>
+#define ORIENT_SSSE3
+#define ORIENT_TARGET __attribute__((target("ssse3")))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ORIENT_NEON
+#define ORIENT_TARGET
+#endif
+
+using namespace cv;
+
+namespace {
+
+// Rotations are done in square tiles of destination image, so both source
+// columns and destination rows of a tile stay in L1 cache
+const int TILE = 32;
+
+// Plain C++ version for region [r0, r1) x [c0, c1) of dst. Source pixels of
+// a destination row lie on a straight line, so only start and step differ.
+void orientRegion(const Mat& src, Mat& dst, int orientation, bool swapRB,
+        int r0, int r1, int c0, int c1) {
+    for (int r = r0; r < r1; ++r) {
+        const uchar* s;
+        ptrdiff_t step;
+        switch (orientation) {
+        case ORIENT_D90:
+            s = src.ptr(c0) + 3 * (src.cols - 1 - r);
+            step = src.step;
+            break;
+        case ORIENT_D180:
+            s = src.ptr(src.rows - 1 - r) + 3 * (src.cols - 1 - c0);
+            step = -3;
+            break;
+        case ORIENT_D270:
+            s = src.ptr(src.rows - 1 - c0) + 3 * r;
+            step = -static_cast<ptrdiff_t>(src.step);
+            break;
+        default:
+            s = src.ptr(r) + 3 * c0;
+            step = 3;
+            break;
+        }
+
+        uchar* d = dst.ptr(r) + 3 * c0;
+        uchar* end = dst.ptr(r) + 3 * c1;
+        if (swapRB) {
+            for (; d != end; d += 3, s += step) {
+                d[0] = s[2];
+                d[1] = s[1];
+                d[2] = s[0];
+            }
+        } else {
+            for (; d != end; d += 3, s += step) {
+                d[0] = s[0];
+                d[1] = s[1];
+                d[2] = s[2];
+            }
+        }
+    }
+}
+
+#ifdef ORIENT_SSSE3
+
+// Row without rotation, 5 pixels per 16 byte register. The 16th byte is
+// written unswapped and fixed by the next iteration or the tail loop.
+ORIENT_TARGET void swapRow(const uchar* s, uchar* d, int pixels) {
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+    int n = 3 * pixels, k = 0;
+    for (; k + 16 <= n; k += 15)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d + k),
+                _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + k)), mask));
+    for (; k < n; k += 3) {
+        d[k] = s[k + 2];
+        d[k + 1] = s[k + 1];
+        d[k + 2] = s[k];
+    }
+}
+
+// Row rotated by 180 degrees with swapped channels is just the source row
+// with bytes in reversed order
+ORIENT_TARGET void reverseRow(const uchar* s, uchar* d, int pixels) {
+    const __m128i mask = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    int n = 3 * pixels, k = 0;
+    for (; k + 16 <= n; k += 16)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d + k),
+                _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + n - 16 - k)), mask));
+    for (; k < n; ++k)
+        d[k] = s[n - 1 - k];
+}
+
+// Load 4 pixels (12 bytes, never more) as 4 32-bit lanes
+ORIENT_TARGET inline __m128i loadPixels(const uchar* p, const __m128i& expand) {
+    int tail;
+    std::memcpy(&tail, p + 8, sizeof(tail));
+    __m128i v = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)),
+            _mm_cvtsi32_si128(tail));
+    return _mm_shuffle_epi8(v, expand);
+}
+
+// Store 4 lanes back as 4 pixels (12 bytes)
+ORIENT_TARGET inline void storePixels(uchar* p, __m128i v, const __m128i& pack) {
+    v = _mm_shuffle_epi8(v, pack);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(p), v);
+    int tail = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    std::memcpy(p + 8, &tail, sizeof(tail));
+}
+
+ORIENT_TARGET inline void transpose4(__m128i& v0, __m128i& v1, __m128i& v2, __m128i& v3) {
+    __m128i t0 = _mm_unpacklo_epi32(v0, v1);
+    __m128i t1 = _mm_unpacklo_epi32(v2, v3);
+    __m128i t2 = _mm_unpackhi_epi32(v0, v1);
+    __m128i t3 = _mm_unpackhi_epi32(v2, v3);
+    v0 = _mm_unpacklo_epi64(t0, t1);
+    v1 = _mm_unpackhi_epi64(t0, t1);
+    v2 = _mm_unpacklo_epi64(t2, t3);
+    v3 = _mm_unpackhi_epi64(t2, t3);
+}
+
+// Rotate 4x4 pixel block with top left corner at (r, c) of dst
+ORIENT_TARGET inline void rotateBlock(const Mat& src, Mat& dst, int orientation, int r, int c,
+        const __m128i& expand, const __m128i& pack) {
+    __m128i v0, v1, v2, v3;
+    if (orientation == ORIENT_D90) {
+        // dst(r, c) = src(c, cols - 1 - r), lane e goes to row r + 3 - e
+        int x = 3 * (src.cols - 4 - r);
+        v0 = loadPixels(src.ptr(c) + x, expand);
+        v1 = loadPixels(src.ptr(c + 1) + x, expand);
+        v2 = loadPixels(src.ptr(c + 2) + x, expand);
+        v3 = loadPixels(src.ptr(c + 3) + x, expand);
+        transpose4(v0, v1, v2, v3);
+        storePixels(dst.ptr(r + 3) + 3 * c, v0, pack);
+        storePixels(dst.ptr(r + 2) + 3 * c, v1, pack);
+        storePixels(dst.ptr(r + 1) + 3 * c, v2, pack);
+        storePixels(dst.ptr(r) + 3 * c, v3, pack);
+    } else {
+        // dst(r, c) = src(rows - 1 - c, r), lane e goes to row r + e
+        int x = 3 * r;
+        int y = src.rows - 1 - c;
+        v0 = loadPixels(src.ptr(y) + x, expand);
+        v1 = loadPixels(src.ptr(y - 1) + x, expand);
+        v2 = loadPixels(src.ptr(y - 2) + x, expand);
+        v3 = loadPixels(src.ptr(y - 3) + x, expand);
+        transpose4(v0, v1, v2, v3);
+        storePixels(dst.ptr(r) + 3 * c, v0, pack);
+        storePixels(dst.ptr(r + 1) + 3 * c, v1, pack);
+        storePixels(dst.ptr(r + 2) + 3 * c, v2, pack);
+        storePixels(dst.ptr(r + 3) + 3 * c, v3, pack);
+    }
+}
+
+#endif
+
+#ifdef ORIENT_NEON
+
+// 16 pixels per iteration, vld3 splits channels to separate registers
+void swapRow(const uchar* s, uchar* d, int pixels) {
+    int k = 0;
+    for (; k + 16 <= pixels; k += 16) {
+        uint8x16x3_t p = vld3q_u8(s + 3 * k);
+        uint8x16_t t = p.val[0];
+        p.val[0] = p.val[2];
+        p.val[2] = t;
+        vst3q_u8(d + 3 * k, p);
+    }
+    for (; k < pixels; ++k) {
+        d[3 * k] = s[3 * k + 2];
+        d[3 * k + 1] = s[3 * k + 1];
+        d[3 * k + 2] = s[3 * k];
+    }
+}
+
+inline uint8x16_t reverse16(uint8x16_t v) {
+    v = vrev64q_u8(v);
+    return vcombine_u8(vget_high_u8(v), vget_low_u8(v));
+}
+
+void reverseRow(const uchar* s, uchar* d, int pixels) {
+    int k = 0;
+    for (; k + 16 <= pixels; k += 16) {
+        uint8x16x3_t p = vld3q_u8(s + 3 * (pixels - 16 - k));
+        uint8x16x3_t q;
+        q.val[0] = reverse16(p.val[2]);
+        q.val[1] = reverse16(p.val[1]);
+        q.val[2] = reverse16(p.val[0]);
+        vst3q_u8(d + 3 * k, q);
+    }
+    for (; k < pixels; ++k) {
+        const uchar* p = s + 3 * (pixels - 1 - k);
+        d[3 * k] = p[2];
+        d[3 * k + 1] = p[1];
+        d[3 * k + 2] = p[0];
+    }
+}
+
+#endif
+
+#ifdef ORIENT_SSSE3
+
+ORIENT_TARGET void orientRotatedSimd(const Mat& src, Mat& dst, int orientation, bool swapRB) {
+    const __m128i expand = swapRB ?
+            _mm_setr_epi8(2, 1, 0, -128, 5, 4, 3, -128, 8, 7, 6, -128, 11, 10, 9, -128) :
+            _mm_setr_epi8(0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128);
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -128, -128, -128, -128);
+
+    for (int tr = 0; tr < dst.rows; tr += TILE) {
+        int r1 = std::min(tr + TILE, dst.rows);
+        for (int tc = 0; tc < dst.cols; tc += TILE) {
+            int c1 = std::min(tc + TILE, dst.cols);
+            // Whole 4x4 blocks, the rest of the tile in plain C++
+            int rb = tr + (r1 - tr) / 4 * 4;
+            int cb = tc + (c1 - tc) / 4 * 4;
+            for (int r = tr; r < rb; r += 4)
+                for (int c = tc; c < cb; c += 4)
+                    rotateBlock(src, dst, orientation, r, c, expand, pack);
+            orientRegion(src, dst, orientation, swapRB, tr, rb, cb, c1);
+            orientRegion(src, dst, orientation, swapRB, rb, r1, tc, c1);
+        }
+    }
+}
+
+#endif
+
+void orientRotated(const Mat& src, Mat& dst, int orientation, bool swapRB) {
+    for (int tr = 0; tr < dst.rows; tr += TILE) {
+        int r1 = std::min(tr + TILE, dst.rows);
+        for (int tc = 0; tc < dst.cols; tc += TILE) {
+            int c1 = std::min(tc + TILE, dst.cols);
+            orientRegion(src, dst, orientation, swapRB, tr, r1, tc, c1);
+        }
+    }
+}
+
+// Whether the SIMD kernels can run on this CPU
+bool simd() {
+#if defined(ORIENT_SSSE3)
+    static const bool ssse3 = (__builtin_cpu_init(), __builtin_cpu_supports("ssse3") != 0);
+    return ssse3;
+#elif defined(ORIENT_NEON)
+    return true;
+#else
+    return false;
+#endif
+}
+
+}
+
+Size orientedSize(const Size& src, int orientation) {
+    if (orientation == ORIENT_D90 || orientation == ORIENT_D270)
+        return Size(src.height, src.width);
+    return src;
+}
+
+void orient(const Mat& src, Mat& dst, int orientation, bool swapRB) {
+    CV_Assert(src.type() == CV_8UC3);
+    dst.create(orientedSize(src.size(), orientation), CV_8UC3);
+    CV_Assert(src.data != dst.data);
+
+    switch (orientation) {
+    case ORIENT_D90:
+    case ORIENT_D270:
+#ifdef ORIENT_SSSE3
+        if (simd()) {
+            orientRotatedSimd(src, dst, orientation, swapRB);
+            break;
+        }
+#endif
+        orientRotated(src, dst, orientation, swapRB);
+        break;
+    case ORIENT_D180:
+#if defined(ORIENT_SSSE3) || defined(ORIENT_NEON)
+        if (swapRB && simd()) {
+            for (int r = 0; r < dst.rows; ++r)
+                reverseRow(src.ptr(src.rows - 1 - r), dst.ptr(r), dst.cols);
+            break;
+        }
+#endif
+        orientRegion(src, dst, orientation, swapRB, 0, dst.rows, 0, dst.cols);
+        break;
+    default:
+        if (!swapRB) {
+            src.copyTo(dst);
+            break;
+        }
+#if defined(ORIENT_SSSE3) || defined(ORIENT_NEON)
+        if (simd()) {
+            for (int r = 0; r < dst.rows; ++r)
+                swapRow(src.ptr(r), dst.ptr(r), dst.cols);
+            break;
+        }
+#endif
+        orientRegion(src, dst, orientation, swapRB, 0, dst.rows, 0, dst.cols);
+        break;
+    }
+}
@@ -0,0 +1,34 @@
+/*******************************************
+ *
+ *	Orientation
+ *   Fused rotation and BGR<->RGB swap of 8-bit three
+ *   channel images, done in one cache blocked pass with
+ *   SSSE3 (when the CPU has it) or NEON and plain C++
+ *   otherwise.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_ORIENTATION_H
+#define URBICAMERA_ORIENTATION_H
+
+#include <cv.h>
+
+// Clockwise rotation, the same as UCamera.flip
+enum Orientation {
+    ORIENT_D0 = 0,
+    ORIENT_D90 = 1,
+    ORIENT_D180 = 2,
+    ORIENT_D270 = 3
+};
+
+// Size of src after rotation
+cv::Size orientedSize(const cv::Size& src, int orientation);
+
+// Write rotated src to dst, swapping first and third channel if swapRB is
+// set. dst is created only if its size or type does not match, so it can
+// point to a preallocated buffer. src and dst must not overlap.
+// Result equals flip + transpose + cvtColor(CV_BGR2RGB) chain formerly used
+// by UCamera.
+void orient(const cv::Mat& src, cv::Mat& dst, int orientation, bool swapRB = true);
+
+#endif
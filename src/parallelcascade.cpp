@@ -0,0 +1,210 @@
+/*******************************************
+ *
+ *	ParallelCascade
+ *   Haar cascade detection spread over several threads.
+ *
+ ********************************************/
+
+#include "parallelcascade.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+using namespace cv;
+using namespace std;
+
+// Window size and maxSize of detectMultiScale appeared in OpenCV 2.3
+#if CV_MAJOR_VERSION > 2 || (CV_MAJOR_VERSION == 2 && CV_MINOR_VERSION >= 3)
+#define PARALLEL_CASCADE
+#endif
+
+// Strips per thread, enough to even out the jobs
+static const int STRIPS_PER_THREAD = 4;
+
+// Same as detectMultiScale groups with
+static const double GROUP_EPS = 0.2;
+
+ParallelCascade::ParallelCascade() : mThreads(1), mCount(0), mNext(0), mRunning(0) {
+}
+
+bool ParallelCascade::largerStrip(const Strip& a, const Strip& b) {
+    return a.rect.area() > b.rect.area();
+}
+
+ParallelCascade::~ParallelCascade() {
+    // Workers are idle between calls, nothing to wait for
+    mPool.reset();
+}
+
+bool ParallelCascade::load(const string& file) {
+    mFile = file;
+    if (!loadCascades(mThreads)) {
+        mCascades.clear();
+        return false;
+    }
+    return true;
+}
+
+bool ParallelCascade::loadCascades(size_t count) {
+    if (mFile.empty())
+        return true;
+    mCascades.clear();
+    for (size_t i = 0; i < count; ++i) {
+        mCascades.push_back(new CascadeClassifier);
+        if (!mCascades.back().load(mFile))
+            return false;
+    }
+
+#ifdef PARALLEL_CASCADE
+    const CascadeClassifier& cascade = mCascades.front();
+    mWindow = cascade.isOldFormatCascade() ? Size(cascade.oldCascade->orig_window_size)
+            : cascade.getOriginalWindowSize();
+#endif
+    return true;
+}
+
+void ParallelCascade::setThreads(size_t threads) {
+    if (threads == 0)
+        threads = max(1u, boost::thread::hardware_concurrency());
+    if (threads == mThreads)
+        return;
+    mThreads = threads;
+    mPool.reset(mThreads > 1 ? new WorkerPool(mThreads - 1) : 0);
+    mFound.resize(mThreads);
+    mStripFound.resize(mThreads);
+    if (!loadCascades(mThreads))
+        throw runtime_error("Could not load cascade classifier " + mFile);
+}
+
+void ParallelCascade::detectMultiScale(const Mat& image, vector<Rect>& objects, double scaleFactor,
+        int minNeighbors, const Size& minSize) {
+    if (mCascades.empty())
+        throw runtime_error("Cascade classifier not loaded");
+    if (mThreads == 1 || mWindow.area() == 0) {
+        mCascades[0].detectMultiScale(image, objects, scaleFactor, minNeighbors, 0 | CV_HAAR_SCALE_IMAGE, minSize);
+        return;
+    }
+
+    // Levels of the pyramid, the same as detectMultiScale goes through
+    mFactors.clear();
+    for (double factor = 1; ; factor *= scaleFactor) {
+        Size window(cvRound(mWindow.width * factor), cvRound(mWindow.height * factor));
+        Size scaled(cvRound(image.cols / factor), cvRound(image.rows / factor));
+        if (scaled.width < mWindow.width || scaled.height < mWindow.height)
+            break;
+        if (window.width < minSize.width || window.height < minSize.height)
+            continue;
+        mFactors.push_back(factor);
+    }
+    mLevels.resize(mFactors.size());
+    parallelFor(mFactors.size(), boost::bind(&ParallelCascade::resizeLevel, this, boost::cref(image), _1, _2));
+
+    // Strips of about the same size, windows starting in a strip's rows fit
+    // in it as it overlaps the next one by a window less one row. Even
+    // heights keep windows stepped by 2 on the rows detectMultiScale uses.
+    double pixels = 0;
+    for (size_t i = 0; i < mLevels.size(); ++i)
+        pixels += mLevels[i].total();
+    double stripPixels = pixels / (mThreads * STRIPS_PER_THREAD);
+    mStrips.clear();
+    for (size_t i = 0; i < mLevels.size(); ++i) {
+        const Mat& level = mLevels[i];
+        int rows = max(mWindow.height, cvRound(stripPixels / level.cols));
+        rows += rows % 2;
+        for (int y = 0; y <= level.rows - mWindow.height; y += rows) {
+            Strip strip;
+            strip.level = i;
+            strip.rect = Rect(0, y, level.cols, min(level.rows - y, rows + mWindow.height - 1));
+            mStrips.push_back(strip);
+        }
+    }
+    // Biggest strips first, the small ones fill the gaps at the end
+    sort(mStrips.begin(), mStrips.end(), largerStrip);
+
+    for (size_t i = 0; i < mFound.size(); ++i)
+        mFound[i].clear();
+    parallelFor(mStrips.size(), boost::bind(&ParallelCascade::detectStrip, this, _1, _2));
+
+    objects.clear();
+    for (size_t i = 0; i < mFound.size(); ++i)
+        objects.insert(objects.end(), mFound[i].begin(), mFound[i].end());
+    groupRectangles(objects, minNeighbors, GROUP_EPS);
+
+    // Level 0 may be the image itself, which is not ours to resize into
+    if (!mLevels.empty() && mLevels[0].data == image.data)
+        mLevels[0] = Mat();
+}
+
+void ParallelCascade::resizeLevel(const Mat& image, size_t, size_t level) {
+    double factor = mFactors[level];
+    Size scaled(cvRound(image.cols / factor), cvRound(image.rows / factor));
+    if (level == 0 && scaled == image.size())
+        mLevels[level] = image;
+    else
+        resize(image, mLevels[level], scaled, 0, 0, INTER_LINEAR);
+}
+
+void ParallelCascade::detectStrip(size_t thread, size_t index) {
+#ifdef PARALLEL_CASCADE
+    const Strip& strip = mStrips[index];
+    double factor = mFactors[strip.level];
+
+    // A call at the window size steps windows by 2 pixels, detectMultiScale
+    // does so only up to factor 2 and takes every position above it. Such
+    // levels are evaluated at all four offsets of the 2 pixel grid.
+    int offsets = factor > 2. ? 2 : 1;
+    vector<Rect>& found = mStripFound[thread];
+    for (int dy = 0; dy < offsets; ++dy)
+        for (int dx = 0; dx < offsets; ++dx) {
+            Rect rect(strip.rect.x + dx, strip.rect.y + dy, strip.rect.width - dx, strip.rect.height - dy);
+            if (rect.width < mWindow.width || rect.height < mWindow.height)
+                continue;
+
+            // Window of the cascade only, raw detections grouped later
+            mCascades[thread].detectMultiScale(mLevels[strip.level](rect), found, 1.1, 0,
+                    0 | CV_HAAR_SCALE_IMAGE, mWindow, mWindow);
+            for (size_t i = 0; i < found.size(); ++i)
+                mFound[thread].push_back(Rect(cvRound((found[i].x + rect.x) * factor),
+                        cvRound((found[i].y + rect.y) * factor),
+                        cvRound(found[i].width * factor), cvRound(found[i].height * factor)));
+        }
+#endif
+}
+
+void ParallelCascade::parallelFor(size_t count, const boost::function<void(size_t, size_t)>& job) {
+    mJob = job;
+    mCount = count;
+    mNext = 0;
+    mError.clear();
+    mRunning = mThreads;
+    for (size_t i = 1; i < mThreads; ++i)
+        mPool->post(boost::bind(&ParallelCascade::drain, this, i));
+    drain(0);
+
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    while (mRunning > 0)
+        mDone.wait(lock);
+    if (!mError.empty())
+        throw runtime_error(mError);
+}
+
+void ParallelCascade::drain(size_t thread) {
+    try {
+        for (size_t i = mNext++; i < mCount; i = mNext++)
+            mJob(thread, i);
+    } catch (std::exception& e) {
+        boost::lock_guard<boost::mutex> lock(mMutex);
+        if (mError.empty())
+            mError = e.what();
+        // Nothing left for the others
+        mNext = mCount;
+    }
+
+    boost::lock_guard<boost::mutex> lock(mMutex);
+    if (--mRunning == 0)
+        mDone.notify_all();
+}
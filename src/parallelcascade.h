@@ -0,0 +1,98 @@
+/*******************************************
+ *
+ *	ParallelCascade
+ *   Haar cascade detection spread over several threads.
+ *
+ *   The image pyramid of detectMultiScale is built level by
+ *   level in parallel, then every level is cut into
+ *   horizontal strips overlapping by a detection window and
+ *   the strips are evaluated in parallel, the biggest first.
+ *   Raw detections of all strips are grouped once, so
+ *   duplicates found at strip seams are merged like
+ *   neighbouring detections of a single call.
+ *
+ *   Classifiers are not thread safe, every thread has its
+ *   own copy of the cascade.
+ *
+ *   Needs OpenCV 2.3 (window size and maxSize of
+ *   CascadeClassifier), with older versions every call is
+ *   single threaded.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_PARALLELCASCADE_H
+#define URBICAMERA_PARALLELCASCADE_H
+
+#include <cv.h>
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+#include <vector>
+
+#include "workerpool.h"
+
+class ParallelCascade : boost::noncopyable {
+public:
+    ParallelCascade();
+    ~ParallelCascade();
+
+    // Loads the cascade classifier, false on failure
+    bool load(const std::string& file);
+    bool empty() const { return mCascades.empty(); }
+
+    // Threads evaluating the cascade, the calling one included, 0 - one per
+    // core. 1 runs detectMultiScale of OpenCV as is, so does any count
+    // before OpenCV 2.3.
+    void setThreads(size_t threads);
+    size_t threads() const { return mThreads; }
+
+    // detectMultiScale of CascadeClassifier with CV_HAAR_SCALE_IMAGE
+    void detectMultiScale(const cv::Mat& image, std::vector<cv::Rect>& objects, double scaleFactor,
+            int minNeighbors, const cv::Size& minSize);
+
+private:
+    // Part of a pyramid level evaluated by one job
+    struct Strip {
+        size_t level;
+        cv::Rect rect; // in level coordinates
+    };
+
+    static bool largerStrip(const Strip& a, const Strip& b);
+    bool loadCascades(size_t count);
+    // Runs job(thread, i) for i below count on all threads
+    void parallelFor(size_t count, const boost::function<void(size_t, size_t)>& job);
+    void drain(size_t thread);
+    void resizeLevel(const cv::Mat& image, size_t thread, size_t level);
+    void detectStrip(size_t thread, size_t strip);
+
+    std::string mFile;
+    size_t mThreads;
+    boost::ptr_vector<cv::CascadeClassifier> mCascades; // one per thread
+    boost::scoped_ptr<WorkerPool> mPool; // threads besides the calling one
+
+    // Pyramid of the current image, kept between frames
+    std::vector<double> mFactors;
+    std::vector<cv::Mat> mLevels;
+    std::vector<Strip> mStrips;
+    std::vector<std::vector<cv::Rect> > mFound; // per thread, image coordinates
+    std::vector<std::vector<cv::Rect> > mStripFound; // per thread, strip coordinates
+    cv::Size mWindow; // detection window of the cascade
+
+    // Current parallelFor
+    boost::function<void(size_t, size_t)> mJob;
+    size_t mCount;
+    boost::atomic<size_t> mNext;
+    boost::mutex mMutex;
+    boost::condition_variable mDone;
+    size_t mRunning; // threads not done yet
+    std::string mError; // first job failure
+};
+
+#endif
@@ -0,0 +1,45 @@
+/*******************************************
+ *
+ *	ScratchPool
+ *   Buffers reused from frame to frame.
+ *
+ ********************************************/
+
+#include "scratchpool.h"
+
+using namespace cv;
+using namespace std;
+
+bool ScratchPool::unused(const Mat& buffer) {
+    // Reference count is updated atomically, a buffer released by another
+    // thread shows up here a bit later at worst
+    return buffer.refcount && *buffer.refcount == 1;
+}
+
+Mat& ScratchPool::get(size_t slot, const Size& size, int type) {
+    if (slot >= mSlots.size())
+        mSlots.resize(slot + 1);
+    Mat& buffer = mSlots[slot];
+    if (buffer.size() != size || buffer.type() != type) {
+        buffer.create(size, type);
+        ++mAllocations;
+    }
+    return buffer;
+}
+
+Mat ScratchPool::take(const Size& size, int type) {
+    for (size_t i = 0; i < mTaken.size(); ) {
+        if (!unused(mTaken[i])) {
+            ++i;
+            continue;
+        }
+        if (mTaken[i].size() == size && mTaken[i].type() == type)
+            return mTaken[i];
+        // Left over from another resolution
+        mTaken.erase(mTaken.begin() + i);
+    }
+
+    mTaken.push_back(Mat(size, type));
+    ++mAllocations;
+    return mTaken.back();
+}
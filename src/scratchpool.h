@@ -0,0 +1,47 @@
+/*******************************************
+ *
+ *	ScratchPool
+ *   Buffers reused from frame to frame. Fixed slots hold
+ *   temporary images of a detector, take() hands out
+ *   buffers that outlive the frame and returns them to the
+ *   pool once nobody refers to them. Buffers are allocated
+ *   again only when size or type changes, and every
+ *   allocation is counted.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_SCRATCHPOOL_H
+#define URBICAMERA_SCRATCHPOOL_H
+
+#include <cv.h>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <vector>
+
+class ScratchPool : boost::noncopyable {
+public:
+    ScratchPool() : mAllocations(0) {}
+
+    // Buffer of the given slot, reallocated only if size or type differ
+    cv::Mat& get(size_t slot, const cv::Size& size, int type);
+
+    // Buffer nobody else refers to, returns to the pool when all its copies
+    // are released
+    cv::Mat take(const cv::Size& size, int type);
+
+    // Number of buffers allocated so far
+    boost::uint64_t allocations() const { return mAllocations; }
+
+    // Whether only the pool refers to the buffer
+    static bool unused(const cv::Mat& buffer);
+
+private:
+    std::vector<cv::Mat> mSlots;
+    std::vector<cv::Mat> mTaken; // buffers handed out by take()
+    boost::atomic<boost::uint64_t> mAllocations;
+};
+
+#endif
@@ -0,0 +1,179 @@
+/*******************************************
+ *
+ *	ShmFrame
+ *   Frame transport through a shared memory segment.
+ *
+ ********************************************/
+
+#include "shmframe.h"
+
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+using namespace boost::interprocess;
+using namespace std;
+
+namespace shmframe {
+
+static const boost::uint32_t MAGIC = 0x55434d46; // "UCMF"
+static const size_t ALIGN = 64;
+
+struct SegmentHeader {
+    boost::uint32_t magic;
+    boost::uint32_t slots;
+    boost::uint64_t capacity;
+    boost::atomic<boost::uint64_t> latest; // seq << 32 | slot
+    boost::atomic<boost::uint32_t> acquired; // seq of the last frame pinned by a reader
+};
+
+struct SlotHeader {
+    boost::atomic<boost::uint32_t> version; // odd while the slot is written
+    boost::atomic<boost::uint32_t> readers; // pinned by that many readers
+    boost::uint32_t seq;
+    boost::int32_t width;
+    boost::int32_t height;
+    boost::int32_t type;
+    boost::int32_t format;
+};
+
+static size_t aligned(size_t size) {
+    return (size + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+static size_t slotStride(size_t capacity) {
+    return aligned(sizeof(SlotHeader)) + aligned(capacity);
+}
+
+static SlotHeader* slotAt(SegmentHeader* header, unsigned int slot) {
+    char* base = reinterpret_cast<char*>(header) + aligned(sizeof(SegmentHeader));
+    return reinterpret_cast<SlotHeader*>(base + slot * slotStride(header->capacity));
+}
+
+static unsigned char* slotData(SlotHeader* slot) {
+    return reinterpret_cast<unsigned char*>(slot) + aligned(sizeof(SlotHeader));
+}
+
+}
+
+using namespace shmframe;
+
+ShmFrameWriter::ShmFrameWriter(const string& name, size_t slots, size_t capacity) :
+        mName(name), mHeader(0), mNextSlot(0) {
+    if (slots < 2)
+        slots = 2;
+
+    shared_memory_object::remove(mName.c_str());
+    shared_memory_object(create_only, mName.c_str(), read_write).swap(mSegment);
+    mSegment.truncate(aligned(sizeof(SegmentHeader)) + slots * slotStride(capacity));
+    mapped_region(mSegment, read_write).swap(mRegion);
+
+    mHeader = new (mRegion.get_address()) SegmentHeader;
+    mHeader->slots = slots;
+    mHeader->capacity = capacity;
+    mHeader->latest = 0;
+    mHeader->acquired = 0;
+    for (unsigned int i = 0; i < slots; ++i) {
+        SlotHeader* slot = new (slotAt(mHeader, i)) SlotHeader;
+        slot->version = 0;
+        slot->readers = 0;
+        slot->seq = 0;
+    }
+    // Readers check magic number last
+    boost::atomic_thread_fence(boost::memory_order_release);
+    mHeader->magic = MAGIC;
+}
+
+ShmFrameWriter::~ShmFrameWriter() {
+    shared_memory_object::remove(mName.c_str());
+}
+
+bool ShmFrameWriter::write(const cv::Mat& frame, unsigned int seq, int format) {
+    size_t size = frame.total() * frame.elemSize();
+    if (size > mHeader->capacity)
+        throw runtime_error("Frame does not fit into shared memory slot");
+
+    for (unsigned int attempt = 0; attempt < mHeader->slots; ++attempt) {
+        unsigned int index = mNextSlot;
+        mNextSlot = (mNextSlot + 1) % mHeader->slots;
+        SlotHeader* slot = slotAt(mHeader, index);
+
+        // Mark slot as written first, then check readers. A reader pins the
+        // slot first and then checks version, so one of us always backs off.
+        boost::uint32_t version = slot->version.load(boost::memory_order_relaxed);
+        slot->version.store(version + 1);
+        if (slot->readers.load() != 0) {
+            slot->version.store(version);
+            continue;
+        }
+
+        if (frame.isContinuous())
+            memcpy(slotData(slot), frame.data, size);
+        else
+            frame.copyTo(cv::Mat(frame.rows, frame.cols, frame.type(), slotData(slot)));
+        slot->seq = seq;
+        slot->width = frame.cols;
+        slot->height = frame.rows;
+        slot->type = frame.type();
+        slot->format = format;
+        slot->version.store(version + 2, boost::memory_order_release);
+
+        mHeader->latest.store(static_cast<boost::uint64_t>(seq) << 32 | index,
+                boost::memory_order_release);
+        return true;
+    }
+    // Every slot is pinned by a reader
+    return false;
+}
+
+bool ShmFrameWriter::latest(unsigned int& slot, unsigned int& seq) const {
+    boost::uint64_t last = mHeader->latest.load(boost::memory_order_acquire);
+    seq = static_cast<unsigned int>(last >> 32);
+    slot = static_cast<unsigned int>(last & 0xffffffff);
+    return seq != 0;
+}
+
+unsigned int ShmFrameWriter::acquired() const {
+    return mHeader->acquired.load(boost::memory_order_relaxed);
+}
+
+void ShmFrameView::release() {
+    if (mSlot) {
+        --mSlot->readers;
+        mSlot = 0;
+    }
+    image = cv::Mat();
+}
+
+ShmFrameReader::ShmFrameReader(const string& name) :
+        mName(name), mHeader(0) {
+    shared_memory_object(open_only, mName.c_str(), read_write).swap(mSegment);
+    mapped_region(mSegment, read_write).swap(mRegion);
+
+    mHeader = static_cast<SegmentHeader*>(mRegion.get_address());
+    if (mRegion.get_size() < sizeof(SegmentHeader) || mHeader->magic != MAGIC)
+        throw runtime_error("Not a frame segment: " + mName);
+    boost::atomic_thread_fence(boost::memory_order_acquire);
+}
+
+bool ShmFrameReader::acquire(unsigned int index, unsigned int seq, ShmFrameView& view) {
+    view.release();
+    if (index >= mHeader->slots)
+        return false;
+
+    SlotHeader* slot = slotAt(mHeader, index);
+    ++slot->readers;
+    boost::uint32_t version = slot->version.load();
+    boost::atomic_thread_fence(boost::memory_order_acquire);
+    if ((version & 1) || slot->seq != seq) {
+        --slot->readers;
+        return false;
+    }
+
+    mHeader->acquired.store(seq, boost::memory_order_relaxed);
+    view.mSlot = slot;
+    view.seq = seq;
+    view.format = slot->format;
+    view.image = cv::Mat(slot->height, slot->width, slot->type, slotData(slot));
+    return true;
+}
@@ -0,0 +1,95 @@
+/*******************************************
+ *
+ *	ShmFrame
+ *   Frame transport through a shared memory segment.
+ *   UCamera writes every frame into one of the slots and
+ *   publishes only a small descriptor, detectors map the
+ *   segment and process the slot in place.
+ *
+ *   A reader pins a slot by increasing its reader count,
+ *   the writer never touches pinned slots and drops the
+ *   frame if all slots are pinned, so neither side waits.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_SHMFRAME_H
+#define URBICAMERA_SHMFRAME_H
+
+#include <cv.h>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <string>
+
+namespace shmframe {
+
+struct SegmentHeader;
+struct SlotHeader;
+
+}
+
+class ShmFrameWriter : boost::noncopyable {
+public:
+    // Creates (or replaces) segment with given number of slots, each able
+    // to hold capacity bytes
+    ShmFrameWriter(const std::string& name, size_t slots, size_t capacity);
+    ~ShmFrameWriter();
+
+    const std::string& name() const { return mName; }
+
+    // Copy frame to a slot not used by any reader. Returns false if the
+    // frame was dropped.
+    bool write(const cv::Mat& frame, unsigned int seq, int format);
+
+    // Slot and sequence number of the last written frame
+    bool latest(unsigned int& slot, unsigned int& seq) const;
+    // Sequence number of the last frame pinned by a reader, 0 - none yet
+    unsigned int acquired() const;
+
+private:
+    std::string mName;
+    boost::interprocess::shared_memory_object mSegment;
+    boost::interprocess::mapped_region mRegion;
+    shmframe::SegmentHeader* mHeader;
+    unsigned int mNextSlot;
+};
+
+// Frame pinned in the shared memory, released on destruction
+class ShmFrameView : boost::noncopyable {
+public:
+    ShmFrameView() : mSlot(0) {}
+    ~ShmFrameView() { release(); }
+
+    void release();
+
+    unsigned int seq;
+    int format;
+    cv::Mat image; // points directly into the segment
+
+private:
+    friend class ShmFrameReader;
+    shmframe::SlotHeader* mSlot;
+};
+
+class ShmFrameReader : boost::noncopyable {
+public:
+    explicit ShmFrameReader(const std::string& name);
+
+    const std::string& name() const { return mName; }
+
+    // Pin frame seq stored in the slot. Returns false if the slot already
+    // holds another frame.
+    bool acquire(unsigned int slot, unsigned int seq, ShmFrameView& view);
+
+private:
+    std::string mName;
+    boost::interprocess::shared_memory_object mSegment;
+    boost::interprocess::mapped_region mRegion;
+    shmframe::SegmentHeader* mHeader;
+};
+
+#endif
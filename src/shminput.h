@@ -0,0 +1,66 @@
+/*******************************************
+ *
+ *	ShmFrameInput
+ *   Detector side of the shared memory transport. Keeps
+ *   the segment named in the UCamera descriptor mapped and
+ *   pins frames it points to.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_SHMINPUT_H
+#define URBICAMERA_SHMINPUT_H
+
+#include <urbi/uobject.hh>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+
+#include "shmframe.h"
+
+class ShmFrameInput {
+public:
+    // Frame pinned for as long as the returned pointer lives, keeps the
+    // segment mapped even if the input moves to another one. Null if the
+    // frame was already replaced.
+    boost::shared_ptr<ShmFrameView> acquire(const urbi::UList& descriptor) {
+        boost::shared_ptr<Hold> hold(new Hold);
+        if (!acquire(descriptor, hold->view))
+            return boost::shared_ptr<ShmFrameView>();
+        hold->reader = mReader;
+        return boost::shared_ptr<ShmFrameView>(hold, &hold->view);
+    }
+
+    // descriptor - [segment, slot, sequence, width, height, format]
+    bool acquire(const urbi::UList& descriptor, ShmFrameView& view) {
+        if (descriptor.size() < 6)
+            return false;
+
+        std::string name = descriptor[0];
+        if (!mReader || mReader->name() != name)
+            mReader.reset(new ShmFrameReader(name));
+
+        int slot = descriptor[1];
+        int seq = descriptor[2];
+        if (!mReader->acquire(slot, seq, view))
+            return false; // frame already replaced by a newer one
+
+        if (view.format != urbi::IMAGE_RGB || view.image.type() != CV_8UC3) {
+            view.release();
+            throw std::runtime_error("Only RGB frames are supported");
+        }
+        return true;
+    }
+
+private:
+    // The view is released before the reader goes away
+    struct Hold : boost::noncopyable {
+        boost::shared_ptr<ShmFrameReader> reader;
+        ShmFrameView view;
+    };
+
+    boost::shared_ptr<ShmFrameReader> mReader;
+};
+
+#endif
@@ -0,0 +1,136 @@
+/*******************************************
+ *
+ *	StageTimer
+ *   Scoped timers of image processing stages.
+ *
+ ********************************************/
+
+#include "stagetimer.h"
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <set>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Event {
+    const char* owner;
+    int stage;
+    int64 start;
+    int64 end;
+};
+
+// Stages recorded by one thread. Only the owning thread writes, readers
+// copy the events and drop those overwritten meanwhile.
+struct Ring {
+    static const size_t SIZE = 4096;
+
+    explicit Ring(int id) : thread(id), head(0) {}
+
+    int thread;
+    boost::atomic<boost::uint64_t> head; // events written so far
+    Event events[SIZE];
+};
+
+struct Registry {
+    boost::mutex mutex;
+    vector<boost::shared_ptr<Ring> > rings; // kept after their threads exit
+    set<string> owners;
+};
+
+Registry& registry() {
+    static Registry registry;
+    return registry;
+}
+
+// Rings are owned by the registry
+void keepRing(Ring*) {}
+
+Ring& threadRing() {
+    static boost::thread_specific_ptr<Ring> ring(&keepRing);
+    if (!ring.get()) {
+        Registry& r = registry();
+        boost::mutex::scoped_lock lock(r.mutex);
+        r.rings.push_back(boost::shared_ptr<Ring>(new Ring(static_cast<int>(r.rings.size()) + 1)));
+        ring.reset(r.rings.back().get());
+    }
+    return *ring;
+}
+
+}
+
+const char* stageName(int stage) {
+    static const char* names[STAGE_COUNT] = {
+        "resize", "convert", "threshold", "filter", "motion", "detect", "moments", "draw", "publish"
+    };
+    return stage >= 0 && stage < STAGE_COUNT ? names[stage] : "unknown";
+}
+
+StageTimes::StageTimes() : mEnabled(false), mOwner("") {
+    for (int i = 0; i < STAGE_COUNT; ++i)
+        mAverage[i] = 0;
+}
+
+void StageTimes::setOwner(const string& owner) {
+    Registry& r = registry();
+    boost::mutex::scoped_lock lock(r.mutex);
+    mOwner = r.owners.insert(owner).first->c_str();
+}
+
+void StageTimes::add(int stage, int64 start, int64 end) {
+    // Exponential average over roughly the last 20 frames
+    double time = (end - start) * 1000. / cv::getTickFrequency();
+    mAverage[stage] = mAverage[stage] == 0 ? time : mAverage[stage] * 0.95 + time * 0.05;
+
+    Ring& ring = threadRing();
+    boost::uint64_t head = ring.head.load(boost::memory_order_relaxed);
+    Event& event = ring.events[head % Ring::SIZE];
+    event.owner = mOwner;
+    event.stage = stage;
+    event.start = start;
+    event.end = end;
+    ring.head.store(head + 1, boost::memory_order_release);
+}
+
+void writeStageTrace(ostream& out) {
+    vector<boost::shared_ptr<Ring> > rings;
+    {
+        Registry& r = registry();
+        boost::mutex::scoped_lock lock(r.mutex);
+        rings = r.rings;
+    }
+
+    double usPerTick = 1e6 / cv::getTickFrequency();
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    vector<Event> events;
+    for (size_t i = 0; i < rings.size(); ++i) {
+        Ring& ring = *rings[i];
+        boost::uint64_t head = ring.head.load(boost::memory_order_acquire);
+        boost::uint64_t begin = head > Ring::SIZE ? head - Ring::SIZE : 0;
+        events.clear();
+        for (boost::uint64_t k = begin; k < head; ++k)
+            events.push_back(ring.events[k % Ring::SIZE]);
+        // Events the thread overwrote while they were copied are not valid,
+        // nor the one sharing a slot with event now, which may be being
+        // written
+        boost::uint64_t now = ring.head.load(boost::memory_order_acquire);
+        size_t skip = now + 1 > begin + Ring::SIZE ? static_cast<size_t>(now + 1 - begin - Ring::SIZE) : 0;
+
+        for (size_t k = skip; k < events.size(); ++k) {
+            out << (first ? "" : ",") << "\n{\"name\":\"" << stageName(events[k].stage)
+                    << "\",\"cat\":\"" << events[k].owner
+                    << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring.thread
+                    << ",\"ts\":" << static_cast<boost::uint64_t>(events[k].start * usPerTick)
+                    << ",\"dur\":" << (events[k].end - events[k].start) * usPerTick << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+}
@@ -0,0 +1,79 @@
+/*******************************************
+ *
+ *	StageTimer
+ *   Scoped timers of image processing stages. Every
+ *   enabled StageTimes keeps rolling averages of its
+ *   stages and records each measured stage into a ring of
+ *   the calling thread, rings of all threads are dumped as
+ *   Chrome trace JSON (chrome://tracing). A disabled
+ *   StageTimes costs one atomic load per stage.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_STAGETIMER_H
+#define URBICAMERA_STAGETIMER_H
+
+#include <cv.h>
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <ostream>
+#include <string>
+
+enum Stage {
+    STAGE_RESIZE,
+    STAGE_CONVERT, // color conversion
+    STAGE_THRESHOLD, // inRange, absdiff and threshold
+    STAGE_FILTER, // medianBlur
+    STAGE_MOTION, // updateMotionHistory
+    STAGE_DETECT, // detectMultiScale
+    STAGE_MOMENTS,
+    STAGE_DRAW, // overlay of the result image
+    STAGE_PUBLISH, // results to urbi variables
+    STAGE_COUNT
+};
+
+const char* stageName(int stage);
+
+class StageTimes : boost::noncopyable {
+public:
+    StageTimes();
+
+    // Name of the events in the trace, usually the detector name
+    void setOwner(const std::string& owner);
+
+    void enable(bool enabled) { mEnabled.store(enabled, boost::memory_order_relaxed); }
+    bool enabled() const { return mEnabled.load(boost::memory_order_relaxed); }
+
+    // Stage took from start to end ticks, called by one thread at a time
+    void add(int stage, int64 start, int64 end);
+    // Rolling average of the stage [ms], 0 if never measured
+    double average(int stage) const { return mAverage[stage]; }
+
+private:
+    boost::atomic<bool> mEnabled;
+    const char* mOwner; // interned, outlives the events referring to it
+    double mAverage[STAGE_COUNT];
+};
+
+// Measures the enclosing scope as the given stage
+class ScopedStage : boost::noncopyable {
+public:
+    ScopedStage(StageTimes& times, int stage) :
+            mTimes(times.enabled() ? &times : 0), mStage(stage), mStart(mTimes ? cv::getTickCount() : 0) {}
+    ~ScopedStage() {
+        if (mTimes)
+            mTimes->add(mStage, mStart, cv::getTickCount());
+    }
+
+private:
+    StageTimes* mTimes;
+    int mStage;
+    int64 mStart;
+};
+
+// Writes recent stages of all threads as Chrome trace JSON
+void writeStageTrace(std::ostream& out);
+
+#endif
@@ -0,0 +1,144 @@
+/*******************************************
+ *
+ *	SyntheticSource
+ *   Procedural frame source used to benchmark the
+ *   pipeline without a camera.
+ *
+ ********************************************/
+
+#include "syntheticsource.h"
+
+#include <boost/thread.hpp>
+
+#include <cmath>
+#include <stdexcept>
+
+using namespace cv;
+using namespace std;
+
+SyntheticSource::SyntheticSource(int width, int height, double fps, const string& pattern) :
+        mSize(width, height), mFps(fps), mBlobs(false), mNoise(false), mFace(false),
+        mFrame(0), mStartTick(0) {
+    if (width <= 0 || height <= 0)
+        throw runtime_error("Synthetic frame size should be positive");
+
+    // Parse pattern tokens
+    size_t begin = 0;
+    while (begin <= pattern.size()) {
+        size_t end = pattern.find('+', begin);
+        if (end == string::npos)
+            end = pattern.size();
+        string token = pattern.substr(begin, end - begin);
+        begin = end + 1;
+
+        if (token == "blobs")
+            mBlobs = true;
+        else if (token == "noise")
+            mNoise = true;
+        else if (token == "face")
+            mFace = true;
+        else if (token.compare(0, 5, "face=") == 0) {
+            mFace = true;
+            mSprite = imread(token.substr(5));
+            if (mSprite.empty())
+                throw runtime_error("Could not load face sprite " + token.substr(5));
+        } else if (!token.empty())
+            throw runtime_error("Unknown synthetic pattern " + token);
+    }
+}
+
+bool SyntheticSource::grab() {
+    if (mFrame == 0)
+        mStartTick = getTickCount();
+    ++mFrame;
+
+    // Keep requested frame rate
+    if (mFps > 0) {
+        int64 due = mStartTick + static_cast<int64>(mFrame * getTickFrequency() / mFps);
+        int64 now = getTickCount();
+        if (due > now)
+            boost::this_thread::sleep(boost::posix_time::microseconds(
+                    (due - now) * 1000000 / static_cast<int64>(getTickFrequency())));
+    }
+    return true;
+}
+
+vector<SyntheticSource::Object> SyntheticSource::truth(unsigned int frame) const {
+    vector<Object> objects;
+    // Motion does not depend on the pacing, so scenes are identical with
+    // and without frame rate limit
+    double t = frame / (mFps > 0 ? mFps : 30.0);
+
+    if (mBlobs) {
+        static const char* names[] = {"red", "green", "blue"};
+        int radius = min(mSize.width, mSize.height) / 16;
+        for (int i = 0; i < 3; ++i) {
+            double ax = mSize.width / 2 - radius - 1;
+            double ay = mSize.height / 2 - radius - 1;
+            int cx = cvRound(mSize.width / 2 + ax * sin(t * (0.7 + 0.3 * i) + i * 2.1));
+            int cy = cvRound(mSize.height / 2 + ay * cos(t * (0.5 + 0.4 * i) + i * 1.3));
+            Object object;
+            object.name = names[i];
+            object.box = Rect(cx - radius, cy - radius, 2 * radius + 1, 2 * radius + 1);
+            objects.push_back(object);
+        }
+    }
+
+    if (mFace) {
+        int side = min(mSize.width, mSize.height) / 3;
+        int cx = cvRound(mSize.width / 2 + (mSize.width - side) / 2 * sin(t * 0.3));
+        Object object;
+        object.name = "face";
+        object.box = Rect(cx - side / 2, mSize.height / 2 - side / 2, side, side);
+        objects.push_back(object);
+    }
+
+    return objects;
+}
+
+bool SyntheticSource::retrieve(Mat& frame) {
+    frame.create(mSize, CV_8UC3);
+
+    if (mNoise)
+        mRng.fill(frame, RNG::UNIFORM, Scalar::all(0), Scalar::all(256));
+    else
+        frame.setTo(Scalar(96, 96, 96));
+
+    vector<Object> objects = truth(mFrame);
+    for (vector<Object>::const_iterator i = objects.begin(); i != objects.end(); ++i) {
+        if (i->name == "face") {
+            drawFace(frame, i->box);
+            continue;
+        }
+        // Colors are in BGR order, as delivered by a camera
+        Scalar color = i->name == "red" ? Scalar(0, 0, 255) :
+                i->name == "green" ? Scalar(0, 255, 0) : Scalar(255, 0, 0);
+        Point center(i->box.x + i->box.width / 2, i->box.y + i->box.height / 2);
+        circle(frame, center, i->box.width / 2, color, -1);
+    }
+    return true;
+}
+
+void SyntheticSource::drawFace(Mat& frame, const Rect& box) const {
+    Rect visible = box & Rect(0, 0, frame.cols, frame.rows);
+    if (visible.area() == 0)
+        return;
+
+    if (!mSprite.empty()) {
+        Mat roi = frame(visible);
+        Mat scaled;
+        resize(mSprite, scaled, box.size());
+        scaled(Rect(visible.x - box.x, visible.y - box.y, visible.width, visible.height)).copyTo(roi);
+        return;
+    }
+
+    // Simple procedural face
+    Point center(box.x + box.width / 2, box.y + box.height / 2);
+    Size axes(box.width * 2 / 5, box.height / 2);
+    ellipse(frame, center, axes, 0, 0, 360, Scalar(140, 170, 225), -1);
+    int eye = max(box.width / 14, 1);
+    circle(frame, Point(center.x - box.width / 6, center.y - box.height / 8), eye, Scalar(40, 30, 30), -1);
+    circle(frame, Point(center.x + box.width / 6, center.y - box.height / 8), eye, Scalar(40, 30, 30), -1);
+    ellipse(frame, Point(center.x, center.y + box.height / 5), Size(box.width / 6, box.height / 14),
+            0, 0, 180, Scalar(60, 60, 150), max(box.width / 40, 1));
+}
@@ -0,0 +1,57 @@
+/*******************************************
+ *
+ *	SyntheticSource
+ *   Procedural frame source used to benchmark the
+ *   pipeline without a camera. Scene content is a pure
+ *   function of the frame number, so ground truth can be
+ *   recomputed for any already published frame.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_SYNTHETICSOURCE_H
+#define URBICAMERA_SYNTHETICSOURCE_H
+
+#include "framesource.h"
+
+#include <string>
+#include <vector>
+
+class SyntheticSource : public FrameSource {
+public:
+    // Object placed on the scene
+    struct Object {
+        std::string name; // "red", "green", "blue" or "face"
+        cv::Rect box; // bounding box in frame coordinates
+    };
+
+    // pattern - any of "blobs", "noise", "face" or "face=<sprite file>"
+    // joined with '+', fps <= 0 - produce frames as fast as possible
+    SyntheticSource(int width, int height, double fps, const std::string& pattern);
+
+    virtual bool grab();
+    virtual bool retrieve(cv::Mat& frame);
+
+    cv::Size size() const { return mSize; }
+
+    // Number of the last grabbed frame, the first one has number 1
+    unsigned int frame() const { return mFrame; }
+
+    // Objects visible on the given frame
+    std::vector<Object> truth(unsigned int frame) const;
+
+private:
+    void drawFace(cv::Mat& frame, const cv::Rect& box) const;
+
+    cv::Size mSize;
+    double mFps;
+    bool mBlobs;
+    bool mNoise;
+    bool mFace;
+    cv::Mat mSprite;
+
+    unsigned int mFrame;
+    int64 mStartTick;
+    cv::RNG mRng;
+};
+
+#endif
@@ -13,9 +13,27 @@
 #include <cv.h>
 #include <highgui.h>
 
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 
+#include <algorithm>
+#include <exception>
 #include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "framerecord.h"
+#include "framering.h"
+#include "framesource.h"
+#include "framestats.h"
+#include "orientation.h"
+#include "shmframe.h"
+#include "syntheticsource.h"
+#include "workerpool.h"
 
 using namespace cv;
 using namespace urbi;
@@ -33,6 +51,13 @@ public:
 private:
     // Urbi constructor. Throw error in case of error.
     void init(int);
+    // Urbi constructor using procedural frames instead of a camera
+    void initSynthetic(int, int, double, const std::string&);
+    // Urbi constructor replaying a recording, at recorded speed if realTime
+    // is set, as fast as possible otherwise
+    void initReplay(const std::string&, bool);
+    // Common part of the constructors
+    void start();
 
     // Our image variable and dimensions
     UVar image;
@@ -41,48 +66,154 @@ private:
     UVar fps;
     UVar notify;
     UVar flip;
+    UVar truth; // objects on the synthetic frame
+    UVar shm; // shared memory segment name, empty - disabled
+    UVar descriptor; // [segment, slot, sequence, width, height, format] of the last frame
+    UVar lazy; // retrieve and convert only frames somebody reads
+    UVar levels; // number of downscaled levels published besides image
+    UVar push; // image is set as soon as a frame is ready, without readers
+    UVar pushRate; // maximum number of pushed frames per second, 0 - unlimited
+    UVar record; // recording file name, empty - disabled
+    UVar recordSize; // size preallocated for the recording [MB]
+    UVar recorded; // number of frames in the recording
+    UVar jpeg; // compressed image
+    UVar jpegQuality; // 0 - 100
+    UVar jpegRate; // maximum number of encoded frames per second, 0 - unlimited
+    UVar jpegEncodeTime; // time of the last encoding [ms]
+    UVar jpegRatio; // raw size / compressed size of the last frame
+    UVar captured; // frames grabbed from the source
+    UVar published; // frames converted into the ring
+    UVar dropped; // grabbed frames never handed out in image
+    UVar captureFps; // real grab rate since the last reset
+    UVar latencyP50; // capture to image publication [ms]
+    UVar latencyP95;
+    UVar latencyP99;
+    // Values match Orientation
     enum {flipD0, flipD90, flipD180, flipD270} mFlipImage;
 
-    bool mGetNewFrame; //
-    unsigned int mFrame; // ID of already grabed frame
+    boost::atomic<bool> mGetNewFrame; // set by update(), publish at most one frame per period
     unsigned int mAccessFrame; // ID of already retrieved frame
 
     // Called on access.
     void getImage();
     void GetImage();
+    // Publish the newest frame of the ring in image, getValMutex held
+    void publishLatest();
+    // Publish frame seq already read into mMatImage, getValMutex held
+    void publishImage(unsigned int, int64);
     
     //
     void changeNotifyImage(UVar&);
     void changeFlipImage();
+    void changeShm();
+    void changeLazy();
+    void changeLevels();
+    void changePush();
+    void changeRecord();
 
     // Access object to camera
-    VideoCapture videoCapture;
+    boost::scoped_ptr<FrameSource> mSource;
+    SyntheticSource* mSynthetic; // mSource if it is synthetic, 0 otherwise
+    void updateTruth(unsigned int);
 
     // Thread object
     boost::thread grabImageThread;
     // Thread function to grab image
     void grabImageThreadFunction();
+    // Retrieve, orient and publish the last grabbed frame
+    void publishFrame();
 
-    // Mutex and conditional variable to synchronize threads
+    // Mutex to synchronize urbi readers
     boost::mutex getValMutex;
-    boost::mutex grabImageMutex;
-    boost::condition_variable grabImageCond;
-    boost::unique_lock<mutex> grabImageMutexLock;
+
+    // Frames published by the grab thread
+    static const size_t RING_SLOTS = 4;
+    static const int FRAME_WAIT_MS = 100; // bounded wait for a reader
+    boost::scoped_ptr<FrameRing> mRing;
+    Mat mGrabImage; // frame retrieved by the grab thread
+
+    // In lazy mode the grab thread only grabs, unless a reader asks for a
+    // frame it has not seen yet
+    boost::atomic<bool> mLazy;
+    boost::atomic<bool> mRetrieveRequested;
+    unsigned int mGrabbedFrame; // ID of the last grabbed frame
+    int64 mGrabbedTick; // capture time of mGrabbedFrame
+
+    // In push mode the grab thread picks frames to push and converts them
+    // into the ring. pushThreadFunction, run by urbi for as long as push is
+    // set, wakes up on every ring write and sets image, readers are not
+    // needed.
+    boost::atomic<bool> mPush;
+    boost::atomic<int64> mPushInterval; // minimal ticks between pushes, 0 - unlimited
+    int64 mPushTick; // time of the last push, grab thread only
+    boost::atomic<unsigned int> mPushFrame; // ID of the last frame picked for push
+    boost::mutex mPushMutex; // held by a running pushThreadFunction
+    void pushThreadFunction(UVar&);
+
+    // Frames published to out-of-process readers
+    static const size_t SHM_SLOTS = 8;
+    boost::shared_ptr<ShmFrameWriter> mShm;
+    unsigned int mDescriptorFrame; // ID of frame in descriptor
+
+    // Oriented frames appended to a file
+    boost::shared_ptr<FrameRecorder> mRecorder;
 
     // Storage for last captured image. 
     UBinary mBinImage;
     Mat mMatImage;
 
+    // Downscaled images, computed once per frame for all readers.
+    // imageL is RGB image downscaled 2^L times, grayL its grayscale version.
+    boost::ptr_vector<UVar> mLevelImages; // image1, image2, ...
+    boost::ptr_vector<UVar> mGrayImages; // gray0, gray1, ...
+    vector<Mat> mPyramid;
+    vector<Mat> mGrayPyramid;
+    unsigned int mPyramidFrame; // ID of frame in mPyramid
+    boost::atomic<bool> mGetNewLevels; // set by update()
+    void getLevel(UVar&);
+    void publishLevel(UVar&, const Mat&, UImageFormat);
+
+    // JPEG images are encoded in a pool only when jpeg is read
+    static const size_t JPEG_THREADS = 2;
+    boost::scoped_ptr<WorkerPool> mJpegPool;
+    boost::mutex mJpegMutex;
+    vector<uchar> mJpegData; // the newest encoded frame
+    int mJpegWidth, mJpegHeight;
+    unsigned int mJpegFrame; // ID of frame in mJpegData
+    unsigned int mJpegPublished; // ID of frame published in jpeg
+    unsigned int mJpegQueued; // ID of the last frame sent to the pool
+    size_t mJpegInFlight; // number of encodings in progress
+    int64 mJpegQueuedTick;
+    double mJpegEncodeMs, mJpegRatio;
+    void getJpeg();
+    void encodeJpeg(unsigned int, int);
+
+    // Pipeline statistics, copied to UVars at most once per STATS_PERIOD_MS
+    static const int STATS_PERIOD_MS = 1000;
+    FrameStats mStats;
+    int64 mStatsTick;
+    void resetStats();
+    void publishStats();
+
     void fpsChanged();
 };
 
-UCamera::UCamera(const std::string& s) : grabImageMutexLock(grabImageMutex), urbi::UObject(s) {
+UCamera::UCamera(const std::string& s) : urbi::UObject(s) {
     UBindFunction(UCamera, init);
+    UBindFunction(UCamera, initSynthetic);
+    UBindFunction(UCamera, initReplay);
 }
 
 UCamera::~UCamera() {
+    // Wait for pushThreadFunction to notice
+    mPush = false;
+    {
+        lock_guard<mutex> lock(mPushMutex);
+    }
     grabImageThread.interrupt();
     grabImageThread.join();
+    // Encoders read the ring, stop them first
+    mJpegPool.reset();
     // Prevent from double free
     if (mMatImage.data == mBinImage.image.data)
         mBinImage.image.data = NULL;
@@ -90,13 +221,57 @@ UCamera::~UCamera() {
 
 void UCamera::init(int id) {
     cerr << "UCamera::init(" << id << ")" << endl;
+
+    CaptureSource* capture = new CaptureSource(id);
+    mSource.reset(capture);
+    mSynthetic = 0;
+    if (!capture->isOpened())
+        throw runtime_error("Failed to initialize camera");
+
+    start();
+}
+
+void UCamera::initSynthetic(int frameWidth, int frameHeight, double frameRate, const std::string& pattern) {
+    cerr << "UCamera::initSynthetic(" << frameWidth << ", " << frameHeight << ", "
+            << frameRate << ", " << pattern << ")" << endl;
+
+    mSynthetic = new SyntheticSource(frameWidth, frameHeight, frameRate, pattern);
+    mSource.reset(mSynthetic);
+
+    start();
+}
+
+void UCamera::initReplay(const std::string& path, bool realTime) {
+    cerr << "UCamera::initReplay(" << path << ", " << realTime << ")" << endl;
+
+    mSource.reset(new ReplaySource(path, realTime));
+    mSynthetic = 0;
+
+    start();
+}
+
+void UCamera::start() {
     // Urbi constructor
     mGetNewFrame = true;
-    mFrame = mAccessFrame = 0;
+    mAccessFrame = 0;
+    mDescriptorFrame = 0;
+    mPyramidFrame = 0;
+    mGetNewLevels = true;
+    mJpegWidth = mJpegHeight = 0;
+    mJpegFrame = mJpegPublished = mJpegQueued = 0;
+    mJpegInFlight = 0;
+    mJpegQueuedTick = 0;
+    mJpegEncodeMs = mJpegRatio = 0;
+    mGrabbedFrame = 0;
+    mGrabbedTick = 0;
+    mLazy = false;
+    mRetrieveRequested = false;
+    mPush = false;
+    mPushInterval = 0;
+    mPushTick = 0;
+    mPushFrame = 0;
     mFlipImage = flipD0;
-
-    if (!videoCapture.open(id))
-        throw runtime_error("Failed to initialize camera");
+    mStatsTick = 0;
 
     // Bind all variables
     UBindVar(UCamera, image);
@@ -105,25 +280,65 @@ void UCamera::init(int id) {
     UBindVar(UCamera, fps);
     UBindVar(Ucamera, notify);
     UBindVar(UCamera, flip);
+    UBindVar(UCamera, truth);
+    UBindVar(UCamera, shm);
+    UBindVar(UCamera, descriptor);
+    UBindVar(UCamera, lazy);
+    UBindVar(UCamera, levels);
+    UBindVar(UCamera, push);
+    UBindVar(UCamera, pushRate);
+    UBindVars(UCamera, record, recordSize, recorded);
+    UBindVar(UCamera, jpeg);
+    UBindVar(UCamera, jpegQuality);
+    UBindVar(UCamera, jpegRate);
+    UBindVar(UCamera, jpegEncodeTime);
+    UBindVar(UCamera, jpegRatio);
+    UBindVars(UCamera, captured, published, dropped, captureFps, latencyP50, latencyP95, latencyP99);
     flip = 0;
+    truth = UList();
+    shm = "";
+    descriptor = UList();
+    lazy = 0;
+    levels = 0;
+    push = 0;
+    pushRate = 0;
+    record = "";
+    recordSize = 512;
+    recorded = 0;
+    jpegQuality = 80;
+    jpegRate = 0;
+    jpegEncodeTime = 0;
+    jpegRatio = 0;
     
     // Bind all functions
     UBindThreadedFunction(UCamera, getImage, LOCK_INSTANCE);
     UBindThreadedFunction(UCamera, GetImage, LOCK_INSTANCE);
+    UBindFunction(UCamera, resetStats);
 
     // Notify if fps changed
     UNotifyChange(fps, &UCamera::fpsChanged);
     UNotifyChange(notify, &UCamera::changeNotifyImage);
     UNotifyChange(flip, &UCamera::changeFlipImage);
+    UNotifyChange(shm, &UCamera::changeShm);
+    UNotifyChange(lazy, &UCamera::changeLazy);
+    UNotifyChange(levels, &UCamera::changeLevels);
+    UNotifyChange(push, &UCamera::changePush);
+    UNotifyChange(pushRate, &UCamera::changePush);
+    UNotifyThreadedChange(push, &UCamera::pushThreadFunction, LOCK_FUNCTION);
+    UNotifyChange(record, &UCamera::changeRecord);
 
     // Get image size
-    videoCapture >> mMatImage;
+    if (!mSource->grab() || !mSource->retrieve(mMatImage))
+        throw runtime_error("Failed to grab first frame");
+    // Recordings are published from their first frame
+    mSource->rewind();
     width = mMatImage.cols;
     height = mMatImage.rows;
 
     cerr << "\tImage size: x=" << width.as<int>() << " y=" << height.as<int>() << endl;
 
     UNotifyAccess(image, &UCamera::getImage);
+    UNotifyAccess(jpeg, &UCamera::getJpeg);
 
     mBinImage.type = BINARY_IMAGE;
     mBinImage.image.width = width.as<size_t > ();
@@ -131,6 +346,13 @@ void UCamera::init(int id) {
     mBinImage.image.imageFormat = IMAGE_RGB;
     mBinImage.image.size = width.as<size_t > () * height.as<size_t > () * 3;
 
+    // Rotation does not change number of pixels, so the first frame tells
+    // how big every slot has to be
+    mRing.reset(new FrameRing(RING_SLOTS, mBinImage.image.size));
+
+    mStats.reset();
+    publishStats();
+
     // Start video grabbing thread
     grabImageThread = boost::thread(&UCamera::grabImageThreadFunction, this);
 
@@ -144,54 +366,168 @@ void UCamera::grabImageThreadFunction() {
     try {
         while (true) {
             this_thread::interruption_point();
-            if (!videoCapture.grab()) {
+            if (!mSource->grab()) {
 				this_thread::sleep(posix_time::milliseconds(15));
 				continue;
 			}
-            ++mFrame;
-            // Try to populate data
-            if (grabImageMutex.try_lock()) {
-                videoCapture.retrieve(mMatImage);
-                Mat tmp;
-                switch (mFlipImage) {
-                case flipD90:
-                	cv::flip(mMatImage, tmp, 1);
-                	transpose(tmp, mMatImage);
-                	break;
-                case flipD180:
-                	cv::flip(mMatImage, mMatImage, -1);
-                	break;
-                case flipD270:
-                	cv::flip(mMatImage, tmp, 0);
-                	transpose(tmp, mMatImage);
-                	break;
-                }
-                cvtColor(mMatImage, mMatImage, CV_BGR2RGB);
-                grabImageCond.notify_one();
-                grabImageMutex.unlock();
+            mGrabbedTick = getTickCount();
+            ++mGrabbedFrame;
+            mStats.captured();
+
+            // Pushed frames have a consumer by definition
+            bool pushNow = false;
+            if (mPush) {
+                int64 interval = mPushInterval;
+                pushNow = interval == 0 || mGrabbedTick - mPushTick >= interval;
+            }
+
+            // Pushed frame is picked before it is written, the ring write
+            // wakes up pushThreadFunction, which sets image
+            if (pushNow) {
+                mPushTick = mGrabbedTick;
+                mPushFrame = mGrabbedFrame;
+            }
+
+            // Decode only frames somebody is waiting for; a frame that fails
+            // to decode is skipped instead of killing the thread
+            try {
+                if (!mLazy || pushNow || mRetrieveRequested.exchange(false))
+                    publishFrame();
+            } catch (std::exception& e) {
+                cerr << "UCamera::grabImageThreadFunction()" << endl
+                        << "\tFrame skipped: " << e.what() << endl;
             }
         }
     } catch (boost::thread_interrupted&) {
         cerr << "UCamera::grabImageThreadFunction()" << endl
                 << "\tThread stopped" << endl;
-        videoCapture.release();
+        mSource->release();
         return;
     }
 }
 
+void UCamera::publishFrame() {
+    // A frame that fails to decode is left out, the gap in sequence numbers
+    // counts it as dropped
+    if (!mSource->retrieve(mGrabImage))
+        return;
+
+    // Write oriented RGB frame straight into the ring slot
+    bool rotated = mFlipImage == flipD90 || mFlipImage == flipD270;
+    Mat frame = mRing->beginWrite(rotated ? mGrabImage.cols : mGrabImage.rows,
+            rotated ? mGrabImage.rows : mGrabImage.cols, mGrabImage.type());
+    orient(mGrabImage, frame, mFlipImage, !mSource->rgb());
+    unsigned int seq = mRing->endWrite(mGrabbedFrame, mGrabbedTick);
+    mStats.published();
+
+    boost::shared_ptr<ShmFrameWriter> shmWriter = boost::atomic_load(&mShm);
+    if (shmWriter)
+        shmWriter->write(frame, seq, IMAGE_RGB);
+    boost::shared_ptr<FrameRecorder> recorder = boost::atomic_load(&mRecorder);
+    if (recorder)
+        recorder->write(frame, seq, mGrabbedTick, IMAGE_RGB);
+}
+
 void UCamera::getImage() {
+    // Image is set by pushThreadFunction in push mode
+    if (mPush)
+        return;
+
     // Lock access to this method from urbi
     lock_guard<mutex> lock(getValMutex);
     
-    // If there is new frame
-    if(mGetNewFrame) {
-        mGetNewFrame = false;
-
-        grabImageCond.wait(grabImageMutexLock);
-        mBinImage.image.data = mMatImage.data;
-        // Copy frame to an external variable
-        image = mBinImage;
+    // Publish at most one frame per update period
+    if(!mGetNewFrame.exchange(false))
+        return;
+
+    // Frame converted for one reader stays in the ring for the others, ask
+    // for a new one only if this reader has already seen the newest
+    if (mLazy && mRing->latest() == mAccessFrame)
+        mRetrieveRequested = true;
+
+    // Nothing new since the last access, wait a while for the next frame
+    if (!mRing->waitNext(mAccessFrame, posix_time::milliseconds(FRAME_WAIT_MS)))
+        return;
+    publishLatest();
+}
+
+void UCamera::pushThreadFunction(UVar& var) {
+    // Runs in a thread of urbi for as long as push is set. The grab thread
+    // never touches urbi variables, it only writes the ring, which wakes
+    // this loop up right away.
+    if (!var.as<bool>())
+        return;
+    lock_guard<mutex> pushLock(mPushMutex);
+    mPush = true;
+    unsigned int last = mRing->latest();
+    while (mPush) {
+        if (!mRing->waitNext(last, posix_time::milliseconds(FRAME_WAIT_MS)))
+            continue;
+        last = mRing->latest();
+
+        lock_guard<mutex> lock(getValMutex);
+        unsigned int seq = mPushFrame;
+        int64 captureTick;
+        if (seq != mAccessFrame && mRing->read(seq, mMatImage, &captureTick))
+            publishImage(seq, captureTick);
+    }
+}
+
+void UCamera::publishLatest() {
+    unsigned int seq;
+    int64 captureTick;
+    if (!mRing->readLatest(mMatImage, seq, &captureTick) || seq == mAccessFrame)
+        return;
+    publishImage(seq, captureTick);
+}
+
+void UCamera::publishImage(unsigned int seq, int64 captureTick) {
+    unsigned int previous = mAccessFrame;
+    mAccessFrame = seq;
+    if (mSynthetic)
+        updateTruth(seq);
+
+    mBinImage.image.width = mMatImage.cols;
+    mBinImage.image.height = mMatImage.rows;
+    mBinImage.image.size = mMatImage.total() * mMatImage.elemSize();
+    mBinImage.image.data = mMatImage.data;
+    // Copy frame to an external variable
+    image = mBinImage;
+    // Frames between the last two accesses were never published
+    mStats.delivered(seq - previous - 1, captureTick);
+}
+
+void UCamera::updateTruth(unsigned int seq) {
+    // Ring sequence numbers follow grabbed frames, the first frame was
+    // consumed by start() to get the image size
+    vector<SyntheticSource::Object> objects = mSynthetic->truth(seq + 1);
+    UList list;
+    for (vector<SyntheticSource::Object>::const_iterator i = objects.begin(); i != objects.end(); ++i) {
+        // Express boxes in coordinates of the oriented frame
+        Rect box = i->box;
+        int frameWidth = mSynthetic->size().width, frameHeight = mSynthetic->size().height;
+        switch (mFlipImage) {
+        case flipD90:
+            box = Rect(box.y, frameWidth - box.x - box.width, box.height, box.width);
+            break;
+        case flipD180:
+            box = Rect(frameWidth - box.x - box.width, frameHeight - box.y - box.height, box.width, box.height);
+            break;
+        case flipD270:
+            box = Rect(frameHeight - box.y - box.height, box.x, box.height, box.width);
+            break;
+        default:
+            break;
+        }
+        UList object;
+        object.push_back(i->name);
+        object.push_back(box.x);
+        object.push_back(box.y);
+        object.push_back(box.width);
+        object.push_back(box.height);
+        list.push_back(object);
     }
+    truth = list;
 }
 
 void UCamera::GetImage() {
@@ -234,10 +570,235 @@ void UCamera::changeFlipImage() {
     mBinImage.image.height = height.as<size_t > ();
 }
 
+void UCamera::changeShm() {
+    string name = shm.as<string>();
+    boost::shared_ptr<ShmFrameWriter> writer;
+    if (!name.empty())
+        writer.reset(new ShmFrameWriter(name, SHM_SLOTS, mRing->capacity()));
+    boost::atomic_store(&mShm, writer);
+    mDescriptorFrame = 0;
+    descriptor = UList();
+}
+
+void UCamera::changeRecord() {
+    string name = record.as<string>();
+    boost::shared_ptr<FrameRecorder> recorder;
+    if (!name.empty()) {
+        double megabytes = recordSize.as<double>();
+        if (megabytes <= 0)
+            throw runtime_error("recordSize should be positive");
+        recorder.reset(new FrameRecorder(name, static_cast<size_t>(megabytes * 1024 * 1024)));
+    }
+    // The grab thread may still hold the previous recorder, it is closed
+    // when released there
+    boost::atomic_store(&mRecorder, recorder);
+    recorded = 0;
+}
+
+void UCamera::changeLazy() {
+    mLazy = lazy.as<bool>();
+}
+
+void UCamera::changePush() {
+    double rate = pushRate.as<double>();
+    if (rate < 0)
+        throw runtime_error("pushRate should not be negative");
+    mPushInterval = rate > 0 ? static_cast<int64>(getTickFrequency() / rate) : 0;
+    mPush = push.as<bool>();
+}
+
+void UCamera::changeLevels() {
+    lock_guard<mutex> lock(getValMutex);
+
+    int count = levels.as<int>();
+    if (count < 0)
+        throw runtime_error("levels should not be negative");
+
+    mLevelImages.clear();
+    mGrayImages.clear();
+    for (int level = 0; level <= count; ++level) {
+        ostringstream grayName;
+        grayName << "gray" << level;
+        mGrayImages.push_back(new UVar(__name, grayName.str()));
+        UNotifyAccess(mGrayImages.back(), &UCamera::getLevel);
+        if (level == 0)
+            continue;
+        ostringstream imageName;
+        imageName << "image" << level;
+        mLevelImages.push_back(new UVar(__name, imageName.str()));
+        UNotifyAccess(mLevelImages.back(), &UCamera::getLevel);
+    }
+    mPyramidFrame = 0;
+}
+
+void UCamera::getLevel(UVar& var) {
+    // Lock access to this method from urbi
+    lock_guard<mutex> lock(getValMutex);
+
+    // Rebuild at most once per update period, and only for a new frame
+    if (mGetNewLevels.exchange(false)) {
+        if (mLazy && mRing->latest() == mPyramidFrame)
+            mRetrieveRequested = true;
+
+        Mat frame;
+        unsigned int seq;
+        if (mRing->latest() != mPyramidFrame && mRing->readLatest(frame, seq)) {
+            mPyramidFrame = seq;
+            mPyramid.resize(mGrayImages.size());
+            mGrayPyramid.resize(mGrayImages.size());
+            mPyramid[0] = frame;
+            for (size_t level = 1; level < mPyramid.size(); ++level)
+                pyrDown(mPyramid[level - 1], mPyramid[level]);
+            for (size_t level = 0; level < mPyramid.size(); ++level)
+                cvtColor(mPyramid[level], mGrayPyramid[level], CV_RGB2GRAY);
+        }
+    }
+    if (mPyramidFrame == 0)
+        return;
+
+    for (size_t level = 0; level < mGrayImages.size(); ++level)
+        if (mGrayImages[level].get_name() == var.get_name())
+            publishLevel(var, mGrayPyramid[level], IMAGE_GREY8);
+    for (size_t level = 0; level < mLevelImages.size(); ++level)
+        if (mLevelImages[level].get_name() == var.get_name())
+            publishLevel(var, mPyramid[level + 1], IMAGE_RGB);
+}
+
+void UCamera::publishLevel(UVar& var, const Mat& level, UImageFormat format) {
+    UBinary bin;
+    bin.type = BINARY_IMAGE;
+    bin.image.imageFormat = format;
+    bin.image.width = level.cols;
+    bin.image.height = level.rows;
+    bin.image.size = level.total() * level.elemSize();
+    bin.image.data = level.data;
+    var = bin;
+    // Data belongs to the pyramid, prevent from double free
+    bin.image.data = NULL;
+}
+
+void UCamera::getJpeg() {
+    lock_guard<mutex> lock(mJpegMutex);
+
+    // Publish the newest encoded frame
+    if (mJpegFrame != mJpegPublished) {
+        mJpegPublished = mJpegFrame;
+        UBinary bin;
+        bin.type = BINARY_IMAGE;
+        bin.image.imageFormat = IMAGE_JPEG;
+        bin.image.width = mJpegWidth;
+        bin.image.height = mJpegHeight;
+        bin.image.size = mJpegData.size();
+        bin.image.data = &mJpegData[0];
+        jpeg = bin;
+        // Data belongs to mJpegData, prevent from double free
+        bin.image.data = NULL;
+        jpegEncodeTime = mJpegEncodeMs;
+        jpegRatio = mJpegRatio;
+    }
+
+    // Ask for the next one, if there is a new frame, a free encoder and
+    // rate allows
+    if (mLazy && mRing->latest() == mJpegQueued)
+        mRetrieveRequested = true;
+    unsigned int seq = mRing->latest();
+    if (seq == 0 || seq == mJpegQueued)
+        return;
+    int64 now = getTickCount();
+    double rate = jpegRate.as<double>();
+    if (rate > 0 && (now - mJpegQueuedTick) < getTickFrequency() / rate)
+        return;
+    if (!mJpegPool)
+        mJpegPool.reset(new WorkerPool(JPEG_THREADS));
+    if (mJpegInFlight >= mJpegPool->size())
+        return;
+
+    mJpegQueued = seq;
+    mJpegQueuedTick = now;
+    ++mJpegInFlight;
+    int quality = std::max(0, std::min(100, jpegQuality.as<int>()));
+    mJpegPool->post(boost::bind(&UCamera::encodeJpeg, this, seq, quality));
+}
+
+void UCamera::encodeJpeg(unsigned int seq, int quality) {
+    Mat frame, bgr;
+    vector<uchar> data;
+    int64 start = getTickCount();
+    bool encoded = false;
+    // A failed encoding must still leave its place to the next one
+    try {
+        encoded = mRing->read(seq, frame);
+        if (encoded) {
+            cvtColor(frame, bgr, CV_RGB2BGR);
+            vector<int> params;
+            params.push_back(CV_IMWRITE_JPEG_QUALITY);
+            params.push_back(quality);
+            encoded = imencode(".jpg", bgr, data, params) && !data.empty();
+        }
+    } catch (std::exception& e) {
+        cerr << "UCamera::encodeJpeg()" << endl
+                << "\tEncoding failed: " << e.what() << endl;
+        encoded = false;
+    }
+    double encodeMs = (getTickCount() - start) * 1000. / getTickFrequency();
+
+    lock_guard<mutex> lock(mJpegMutex);
+    --mJpegInFlight;
+    // Encoders may finish out of order, keep the newest frame
+    if (encoded && seq > mJpegFrame) {
+        mJpegData.swap(data);
+        mJpegWidth = frame.cols;
+        mJpegHeight = frame.rows;
+        mJpegFrame = seq;
+        mJpegEncodeMs = encodeMs;
+        mJpegRatio = static_cast<double>(frame.total() * frame.elemSize()) / mJpegData.size();
+    }
+}
+
+void UCamera::resetStats() {
+    mStats.reset();
+    publishStats();
+}
+
+void UCamera::publishStats() {
+    mStatsTick = getTickCount();
+    captured = static_cast<double>(mStats.capturedCount());
+    published = static_cast<double>(mStats.publishedCount());
+    dropped = static_cast<double>(mStats.droppedCount());
+    captureFps = mStats.captureFps();
+    latencyP50 = mStats.latencyPercentile(0.50);
+    latencyP95 = mStats.latencyPercentile(0.95);
+    latencyP99 = mStats.latencyPercentile(0.99);
+    boost::shared_ptr<FrameRecorder> recorder = boost::atomic_load(&mRecorder);
+    if (recorder)
+        recorded = static_cast<int>(recorder->frames());
+}
+
 int UCamera::update() {
-    if (mAccessFrame != mFrame) {
-        mGetNewFrame = true;
-        mAccessFrame = mFrame;
+    mGetNewFrame = true;
+    mGetNewLevels = true;
+
+    if ((getTickCount() - mStatsTick) * 1000. / getTickFrequency() >= STATS_PERIOD_MS)
+        publishStats();
+
+    // Descriptor is small, so it is simply published on every update
+    boost::shared_ptr<ShmFrameWriter> shmWriter = boost::atomic_load(&mShm);
+    unsigned int slot, seq;
+    bool written = shmWriter && shmWriter->latest(slot, seq);
+    // Out-of-process readers count as consumers in lazy mode, a new frame
+    // is asked for once one of them has taken the last one
+    if (shmWriter && mLazy && (!written || shmWriter->acquired() == seq))
+        mRetrieveRequested = true;
+    if (written && seq != mDescriptorFrame) {
+        mDescriptorFrame = seq;
+        UList list;
+        list.push_back(shmWriter->name());
+        list.push_back(slot);
+        list.push_back(seq);
+        list.push_back(width.as<int>());
+        list.push_back(height.as<int>());
+        list.push_back(static_cast<int>(IMAGE_RGB));
+        descriptor = list;
     }
     return 0;
 }
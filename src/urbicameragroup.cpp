@@ -0,0 +1,363 @@
+/*******************************************
+ *
+ *	UCameraGroup v1.0
+ *   Several cameras grabbed in lockstep, so stereo and
+ *   multi-view consumers get frames captured at the same
+ *   moment.
+ *	Compiled with OpenCV 2.2
+ *
+ ********************************************/
+
+#include <urbi/uobject.hh>
+
+#include <cv.h>
+#include <highgui.h>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/barrier.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "framerecord.h"
+#include "framering.h"
+#include "framesource.h"
+#include "orientation.h"
+#include "syntheticsource.h"
+
+using namespace cv;
+using namespace urbi;
+using namespace std;
+using namespace boost;
+
+class UCameraGroup : public UObject {
+public:
+    // The class must have a single constructor taking a string.
+    UCameraGroup(const std::string&);
+    virtual ~UCameraGroup();
+
+    virtual int update();
+
+private:
+    // Urbi constructor. Every element of the list is a device number,
+    // ["synthetic", width, height, fps, pattern] or ["replay", file, realTime]
+    void init(UList);
+
+    // Results
+    UVar count; // number of cameras
+    UVar sequence; // sequence number of the published frame set
+    UVar timestamps; // capture time of every frame in the set [ms]
+    UVar skew; // capture time difference in the published set [ms]
+    UVar maxSkew; // the worst skew seen so far [ms]
+    // Parameters
+    UVar fps;
+    UVar notify;
+    // image0, image1, ...
+    boost::ptr_vector<UVar> mImages;
+
+    // Called on access of any image.
+    void getImages();
+    void GetImages();
+
+    void changeNotifyImage(UVar&);
+    void fpsChanged();
+
+    struct Camera {
+        boost::scoped_ptr<FrameSource> source;
+        boost::scoped_ptr<FrameRing> ring;
+        Mat grabImage; // used only by the camera thread
+        bool grabbed;
+        bool retrieved; // frame of the current set is in the ring
+        int64 grabTick;
+        Mat image; // last published image
+        UBinary binImage;
+    };
+    boost::ptr_vector<Camera> mCameras;
+
+    static FrameSource* createSource(const UValue&);
+
+    // One thread per camera, all of them wait for each other before grab
+    // and before retrieve
+    boost::thread_group mThreads;
+    boost::scoped_ptr<boost::barrier> mGrabBarrier;
+    boost::scoped_ptr<boost::barrier> mRetrieveBarrier;
+    void cameraThreadFunction(size_t);
+    void finishSet();
+    void completeSet(unsigned int);
+
+    static const size_t RING_SLOTS = 4;
+    unsigned int mGrabSet; // ID of the set being grabbed, camera threads only
+    unsigned int mLastGrabSet; // ID of the last started set, camera threads only
+    boost::atomic<unsigned int> mSet; // ID of the last complete set
+    unsigned int mAccessSet; // ID of the last published set
+
+    boost::atomic<bool> mGetNewFrame; // set by update()
+    boost::mutex getValMutex;
+};
+
+UCameraGroup::UCameraGroup(const std::string& s) : urbi::UObject(s) {
+    UBindFunction(UCameraGroup, init);
+}
+
+UCameraGroup::~UCameraGroup() {
+    mThreads.interrupt_all();
+    mThreads.join_all();
+    for (size_t i = 0; i < mCameras.size(); ++i) {
+        // Prevent from double free
+        if (mCameras[i].image.data == mCameras[i].binImage.image.data)
+            mCameras[i].binImage.image.data = NULL;
+        mCameras[i].source->release();
+    }
+}
+
+FrameSource* UCameraGroup::createSource(const UValue& description) {
+    if (description.type == DATA_DOUBLE) {
+        int id = static_cast<int>(description.val);
+        CaptureSource* capture = new CaptureSource(id);
+        if (!capture->isOpened()) {
+            delete capture;
+            throw runtime_error("Failed to initialize camera");
+        }
+        return capture;
+    }
+
+    if (description.type == DATA_LIST && description.list->size() == 5
+            && (*description.list)[0].type == DATA_STRING
+            && *(*description.list)[0].stringValue == "synthetic") {
+        const UList& args = *description.list;
+        return new SyntheticSource(static_cast<int>(args[1].val), static_cast<int>(args[2].val),
+                args[3].val, *args[4].stringValue);
+    }
+
+    if (description.type == DATA_LIST && description.list->size() == 3
+            && (*description.list)[0].type == DATA_STRING
+            && *(*description.list)[0].stringValue == "replay") {
+        const UList& args = *description.list;
+        return new ReplaySource(*args[1].stringValue, args[2].val != 0);
+    }
+
+    throw runtime_error("Unknown camera description");
+}
+
+void UCameraGroup::init(UList sources) {
+    cerr << "UCameraGroup::init(" << sources.size() << " cameras)" << endl;
+    if (sources.size() == 0)
+        throw runtime_error("Camera group should have at least one camera");
+
+    mGrabSet = 0;
+    mLastGrabSet = 0;
+    mSet = 0;
+    mAccessSet = 0;
+    mGetNewFrame = true;
+
+    // Bind all variables
+    UBindVars(UCameraGroup, count, sequence, timestamps, skew, maxSkew, fps, notify);
+
+    // Bind all functions
+    UBindThreadedFunction(UCameraGroup, getImages, LOCK_INSTANCE);
+    UBindThreadedFunction(UCameraGroup, GetImages, LOCK_INSTANCE);
+
+    for (size_t i = 0; i < sources.size(); ++i) {
+        Camera* camera = new Camera;
+        mCameras.push_back(camera);
+        camera->source.reset(createSource(sources[i]));
+        camera->grabbed = false;
+        camera->retrieved = false;
+        camera->grabTick = 0;
+
+        // Get image size
+        if (!camera->source->grab() || !camera->source->retrieve(camera->grabImage))
+            throw runtime_error("Failed to grab first frame");
+        camera->ring.reset(new FrameRing(RING_SLOTS,
+                camera->grabImage.total() * camera->grabImage.elemSize()));
+
+        camera->binImage.type = BINARY_IMAGE;
+        camera->binImage.image.imageFormat = IMAGE_RGB;
+        camera->binImage.image.width = camera->grabImage.cols;
+        camera->binImage.image.height = camera->grabImage.rows;
+        camera->binImage.image.size = camera->grabImage.total() * camera->grabImage.elemSize();
+
+        ostringstream name;
+        name << "image" << i;
+        mImages.push_back(new UVar(__name, name.str()));
+        UNotifyAccess(mImages.back(), &UCameraGroup::getImages);
+
+        cerr << "\tCamera " << i << " image size: x=" << camera->grabImage.cols
+                << " y=" << camera->grabImage.rows << endl;
+    }
+
+    count = static_cast<int>(mCameras.size());
+    sequence = 0;
+    timestamps = UList();
+    skew = 0;
+    maxSkew = 0;
+    notify = 1;
+
+    UNotifyChange(fps, &UCameraGroup::fpsChanged);
+    UNotifyChange(notify, &UCameraGroup::changeNotifyImage);
+
+    // Start camera threads
+    mGrabBarrier.reset(new boost::barrier(mCameras.size()));
+    mRetrieveBarrier.reset(new boost::barrier(mCameras.size()));
+    for (size_t i = 0; i < mCameras.size(); ++i)
+        mThreads.create_thread(boost::bind(&UCameraGroup::cameraThreadFunction, this, i));
+
+    // Set update period
+    fps = 25;
+}
+
+void UCameraGroup::cameraThreadFunction(size_t index) {
+    Camera& camera = mCameras[index];
+    try {
+        while (true) {
+            this_thread::interruption_point();
+
+            // Issue all grabs at the same moment
+            // A failing camera only drops its frame, it still has to reach
+            // every barrier or the other cameras would wait forever
+            mGrabBarrier->wait();
+            try {
+                camera.grabbed = camera.source->grab();
+            } catch (std::exception& e) {
+                cerr << "UCameraGroup::cameraThreadFunction()" << endl
+                        << "\tCamera " << index << " grab failed: " << e.what() << endl;
+                camera.grabbed = false;
+            }
+            camera.grabTick = getTickCount();
+
+            // Retrieve only after every camera has grabbed
+            if (mRetrieveBarrier->wait())
+                finishSet();
+            mGrabBarrier->wait();
+
+            unsigned int set = mGrabSet;
+            if (set == 0) {
+                this_thread::sleep(posix_time::milliseconds(15));
+                continue;
+            }
+
+            camera.retrieved = false;
+            bool writing = false;
+            try {
+                if (camera.source->retrieve(camera.grabImage)) {
+                    Mat frame = camera.ring->beginWrite(camera.grabImage.rows,
+                            camera.grabImage.cols, camera.grabImage.type());
+                    writing = true;
+                    orient(camera.grabImage, frame, ORIENT_D0, !camera.source->rgb());
+                    camera.ring->endWrite(set, camera.grabTick);
+                    writing = false;
+                    camera.retrieved = true;
+                }
+            } catch (std::exception& e) {
+                if (writing)
+                    camera.ring->abortWrite();
+                cerr << "UCameraGroup::cameraThreadFunction()" << endl
+                        << "\tCamera " << index << " frame dropped: " << e.what() << endl;
+            }
+
+            // Set is complete when the last camera is done
+            if (mRetrieveBarrier->wait())
+                completeSet(set);
+        }
+    } catch (boost::thread_interrupted&) {
+        return;
+    }
+}
+
+void UCameraGroup::finishSet() {
+    // Called by exactly one camera thread while the others wait, decides
+    // whether the grabbed frames form a set
+    for (size_t i = 0; i < mCameras.size(); ++i)
+        if (!mCameras[i].grabbed) {
+            mGrabSet = 0;
+            return;
+        }
+    // IDs are never reused, some rings may already hold a set that did not
+    // complete
+    mGrabSet = ++mLastGrabSet;
+}
+
+void UCameraGroup::completeSet(unsigned int set) {
+    // Called by exactly one camera thread after all of them retrieved, a set
+    // with a dropped frame is never published
+    for (size_t i = 0; i < mCameras.size(); ++i)
+        if (!mCameras[i].retrieved)
+            return;
+    mSet = set;
+}
+
+void UCameraGroup::getImages() {
+    // Lock access to this method from urbi
+    lock_guard<mutex> lock(getValMutex);
+
+    // Publish at most one set per update period
+    if (!mGetNewFrame.exchange(false))
+        return;
+
+    unsigned int set = mSet;
+    if (set == mAccessSet)
+        return;
+
+    // Read every camera at the same set, a ring may be already one set
+    // ahead of the others
+    vector<int64> ticks(mCameras.size());
+    for (size_t i = 0; i < mCameras.size(); ++i)
+        if (!mCameras[i].ring->read(set, mCameras[i].image, &ticks[i]))
+            return;
+    mAccessSet = set;
+
+    int64 first = ticks[0], last = ticks[0];
+    UList stamps;
+    for (size_t i = 0; i < mCameras.size(); ++i) {
+        first = std::min(first, ticks[i]);
+        last = std::max(last, ticks[i]);
+        stamps.push_back(ticks[i] * 1000. / getTickFrequency());
+    }
+    double setSkew = (last - first) * 1000. / getTickFrequency();
+
+    sequence = static_cast<int>(set);
+    timestamps = stamps;
+    skew = setSkew;
+    if (setSkew > maxSkew.as<double>())
+        maxSkew = setSkew;
+
+    for (size_t i = 0; i < mCameras.size(); ++i) {
+        Camera& camera = mCameras[i];
+        camera.binImage.image.width = camera.image.cols;
+        camera.binImage.image.height = camera.image.rows;
+        camera.binImage.image.size = camera.image.total() * camera.image.elemSize();
+        camera.binImage.image.data = camera.image.data;
+        mImages[i] = camera.binImage;
+    }
+}
+
+void UCameraGroup::GetImages() {
+    getImages();
+}
+
+void UCameraGroup::changeNotifyImage(UVar& var) {
+    // Always unnotify
+    for (size_t i = 0; i < mImages.size(); ++i) {
+        mImages[i].unnotify();
+        if (var.as<bool>())
+            UNotifyAccess(mImages[i], &UCameraGroup::getImages);
+    }
+}
+
+int UCameraGroup::update() {
+    mGetNewFrame = true;
+    return 0;
+}
+
+void UCameraGroup::fpsChanged() {
+    cerr << "UCameraGroup::fpsChanged()" << endl
+            << "\tGroup fps changed to " << fps.as<int>() << endl;
+    USetUpdate(fps.as<int>() > 0 ? 1000.0 / fps.as<int>() : -1.0);
+}
+
+UStart(UCameraGroup);
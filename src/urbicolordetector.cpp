@@ -13,8 +13,22 @@
 #include <cv.h>
 #include <highgui.h>
 
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
+
+#include "batchreader.h"
+#include "colordetector.h"
+#include "framedispatcher.h"
+#include "framemailbox.h"
+#include "scratchpool.h"
+#include "shminput.h"
+#include "stagetimer.h"
 
 using namespace cv;
 using namespace urbi;
@@ -26,23 +40,59 @@ public:
     ~UColorDetector();
 
     int init(UVar& sourceImage); // init object
+    int attach(UVar& descriptor); // read frames from UCamera shared memory
+
+    virtual int update(); // publishes frames processed by other threads
     
 private:
     void changeNotifyImage(UVar&); // change mode function
     void changeScale(UVar&);
+    void changeParameters(); // copies processing parameters for detect()
+    void changeInputPolicy();
+    void changeDispatcher();
     void setColor(int, int, int, int, int, int); // change color
     void SetColor(int, int, int, int, int, int); // change color
+    void addColor(string, int, int, int, int, int, int); // add or change named color
+    void removeColor(string);
+    void learnHistogram(int, int, int, int); // CamShift histogram of a region of the processed image
+    void publishColors(); // named color results to urbi variables
+    UList blobList(const ColorDetector::ColorResult& result); // regions of one color
     void detectFrom(UImage); // image processing function
+    void detectFromShm(UVar&); // image processing of shared memory frame
     void SetImage(UImage);
-
-    // Temporary variables for image processing function
-    Mat mResultImage;
-    
-    // Color in HSV representation
-    Scalar hsv_min;
-    Scalar hsv_max;
+    void publish(); // results of mDetector to urbi variables
+    void publishStages(); // stage timing to urbi variables
+    void changeTrace(UVar&);
+    void changeClassifier(UVar&);
+    void dumpTrace(string); // writes Chrome trace JSON of all detectors
+    UList processVideo(string path); // results of every frame of a video or recording
+    UList processBatch(UList files); // results of every image file
+    UList processFrames(BatchReader& reader);
+    void processThreadFunction(); // processes frames from mMailbox
+    void processFrame(const FrameMailbox::Frame&); // called by both threads
+    void detect(const FrameMailbox::Frame&); // mProcessMutex held
+    void publishResults(); // results of the last frame, mProcessMutex held
+    void publishCounters();
+
+    ColorDetector mDetector; // image processing
     
     int64 mLastTick;
+    double mFps;
+
+    // Processing parameters, copied from urbi variables on the urbi side as
+    // detect() runs on other threads, mProcessMutex held
+    double mScale;
+    double mMinArea;
+    int mMaxBlobs;
+    bool mTracking;
+    int mFullScanInterval;
+    bool mCamShift;
+
+    // Urbi variables are set only on the urbi side, frames processed by
+    // other threads are published by update()
+    static const int PUBLISH_PERIOD_MS = 10;
+    boost::atomic<bool> mResultsPending; // processed frame not published yet
+    boost::uint64_t mPublishedCounts; // sum of mailbox counters last published
 
     // Variables definig the class states
     UVar notifyImage;
@@ -55,21 +105,64 @@ private:
     UVar height; // image height
     UVar fps; // fps processing
     UVar image; //image after processing
+    UVar inputPolicy; // 0 - newest frame only, 1 - queue of queueSize frames, 2 - source waits
+    UVar queueSize;
+    UVar dispatcher; // name of UDispatcher feeding frames, empty - own input
+    UVar received; // frames received from the source
+    UVar processed; // frames processed
+    UVar dropped; // frames dropped by the input policy
+    UVar colors; // names of the colors of addColor
+    UVar colorVisible; // per named color, in the order of colors
+    UVar colorX;
+    UVar colorY;
+    UVar colorArea; // pixels of the processed image
+    UVar minArea; // smallest region in pixels of the processed image
+    UVar maxBlobs; // regions reported per color, at least 1
+    UVar blobs; // regions of the color, [x, y, area, left, top, width, height] each, largest first
+    UVar colorBlobs; // per named color, lists like blobs
+    UVar tracking; // process only a window around the regions found before
+    UVar fullScanInterval; // windowed frames between full scans, 0 - only when a region is lost
+    UVar processedFraction; // part of the image classified by the last frame
+    UVar camShift; // follow the learned histogram of the color instead of segmenting
+    UVar angle; // CamShift box orientation in degrees
+    UVar boxWidth; // CamShift box size in pixels of the processed image
+    UVar boxHeight;
+    UVar classifier; // 0 - HSV thresholds, 1 - precomputed RGB table
+    UVar tableBits; // bits per RGB channel of the table, 4 to 7
+    UVar allocations; // image buffers allocated so far, grows only when size changes
+    UVar trace; // measure processing stages
+    UVar stages; // [stage, average ms] pairs, updated while tracing
     UVar *mInputImage;
+    UVar *mDescriptor;
+    ShmFrameInput mShmInput;
+    ScratchPool mInputPool; // copies of input frames waiting in mMailbox
+    FrameMailbox mMailbox; // frames waiting for processing
+    boost::thread mProcessThread;
+    boost::mutex mProcessMutex; // mDetector is used by one thread at a time
+    string mDispatcher; // registered with this dispatcher
+    boost::mutex mBatchMutex; // one batch at a time
     UBinary mBinImage;
 };
 
-UColorDetector::UColorDetector(const string& s) : urbi::UObject(s) {
+UColorDetector::UColorDetector(const string& s) : urbi::UObject(s), mInputImage(0), mDescriptor(0) {
     UBindFunction(UColorDetector, init);
 }
 
 UColorDetector::~UColorDetector() {
+    if (!mDispatcher.empty())
+        FrameDispatcher::get(mDispatcher).remove(__name);
+    mMailbox.close();
+    mProcessThread.interrupt();
+    mProcessThread.join();
+
     // Prevent of double free error
-    if(mBinImage.image.data == mResultImage.data)
+    if(mBinImage.image.data == mDetector.result().data)
         mBinImage.image.data = 0;
     
     if(mInputImage)
         delete mInputImage;
+    if(mDescriptor)
+        delete mDescriptor;
 }
 
 int UColorDetector::init(UVar& sourceImage) {
@@ -85,12 +178,26 @@ int UColorDetector::init(UVar& sourceImage) {
             notifyImage,
             mode,
             image);
+    UBindVars(UColorDetector, inputPolicy, queueSize, dispatcher, received, processed, dropped);
+    UBindVars(UColorDetector, allocations, trace, stages);
+    UBindVars(UColorDetector, colors, colorVisible, colorX, colorY, colorArea);
+    UBindVars(UColorDetector, classifier, tableBits);
+    UBindVars(UColorDetector, minArea, maxBlobs, blobs, colorBlobs);
+    UBindVars(UColorDetector, tracking, fullScanInterval, processedFraction);
+    UBindVars(UColorDetector, camShift, angle, boxWidth, boxHeight);
 
     // Bind functions
     UBindThreadedFunction(UColorDetector, detectFrom, LOCK_INSTANCE);
     UBindThreadedFunction(UColorDetector, SetImage, LOCK_INSTANCE);
     UBindFunction(UColorDetector, setColor);
     UBindFunction(UColorDetector, SetColor);
+    UBindFunction(UColorDetector, addColor);
+    UBindFunction(UColorDetector, removeColor);
+    UBindFunction(UColorDetector, learnHistogram);
+    UBindFunction(UColorDetector, attach);
+    UBindFunction(UColorDetector, dumpTrace);
+    UBindThreadedFunction(UColorDetector, processVideo, LOCK_FUNCTION);
+    UBindThreadedFunction(UColorDetector, processBatch, LOCK_FUNCTION);
     
     mBinImage.type = BINARY_IMAGE;
     mBinImage.image.imageFormat = IMAGE_RGB;
@@ -102,35 +209,153 @@ int UColorDetector::init(UVar& sourceImage) {
     scale = 1;
     height = -1;
     width = -1;
-
-    hsv_min = hsv_max = Scalar(0, 0, 0, 0);
+    inputPolicy = MAILBOX_COALESCE;
+    queueSize = 2;
+    dispatcher = "";
+    received = 0;
+    processed = 0;
+    dropped = 0;
+    allocations = 0;
+    publishColors();
+    trace = 0;
+    stages = UList();
+    classifier = CLASSIFY_HSV;
+    tableBits = 5;
+    minArea = mDetector.minArea();
+    maxBlobs = static_cast<int>(mDetector.maxBlobs());
+    blobs = UList();
+    tracking = 0;
+    fullScanInterval = mDetector.fullScanInterval();
+    processedFraction = 1;
+    camShift = 0;
+    angle = 0;
+    boxWidth = 0;
+    boxHeight = 0;
+    mDetector.times().setOwner(__name);
+    mLastTick = getTickCount();
+    mFps = 0;
+    mResultsPending = false;
+    mPublishedCounts = 0;
 
     mInputImage = new UVar(sourceImage);
     UNotifyChange(*mInputImage, &UColorDetector::detectFrom);
     UNotifyChange(notifyImage, &UColorDetector::changeNotifyImage);
     UNotifyChange(mode, &UColorDetector::changeNotifyImage);
     UNotifyChange(scale, &UColorDetector::changeScale);
+    UNotifyChange(inputPolicy, &UColorDetector::changeInputPolicy);
+    UNotifyChange(queueSize, &UColorDetector::changeInputPolicy);
+    UNotifyChange(dispatcher, &UColorDetector::changeDispatcher);
+    UNotifyChange(trace, &UColorDetector::changeTrace);
+    UNotifyChange(classifier, &UColorDetector::changeClassifier);
+    UNotifyChange(tableBits, &UColorDetector::changeClassifier);
+    UNotifyChange(scale, &UColorDetector::changeParameters);
+    UNotifyChange(minArea, &UColorDetector::changeParameters);
+    UNotifyChange(maxBlobs, &UColorDetector::changeParameters);
+    UNotifyChange(tracking, &UColorDetector::changeParameters);
+    UNotifyChange(fullScanInterval, &UColorDetector::changeParameters);
+    UNotifyChange(camShift, &UColorDetector::changeParameters);
+    changeParameters();
+    USetUpdate(PUBLISH_PERIOD_MS);
+
+    // Start processing thread
+    mProcessThread = boost::thread(&UColorDetector::processThreadFunction, this);
     
     return 0;
 }
 
-void UColorDetector::setColor(int H_min, int H_max, int S_min, int S_max, int V_min, int V_max) {
-    // Set HSV min points
-    hsv_min = Scalar(H_min * 180 / 255, S_min, V_min, 0);
+int UColorDetector::attach(UVar& descriptor) {
+    // Frames come from shared memory instead of the image variable
+    mInputImage->unnotify();
+    if(mDescriptor)
+        delete mDescriptor;
+    mDescriptor = new UVar(descriptor);
+    UNotifyChange(*mDescriptor, &UColorDetector::detectFromShm);
 
-    // Set HSV max points
-    hsv_max = Scalar(H_max * 180 / 255, S_max, V_max, 0);
+    return 0;
+}
+
+void UColorDetector::setColor(int H_min, int H_max, int S_min, int S_max, int V_min, int V_max) {
+    // Set HSV min and max points
+    boost::lock_guard<boost::mutex> lock(mProcessMutex);
+    mDetector.setColor(Scalar(H_min * 180 / 255, S_min, V_min, 0),
+            Scalar(H_max * 180 / 255, S_max, V_max, 0));
 }
 
 void UColorDetector::SetColor(int H_min, int H_max, int S_min, int S_max, int V_min, int V_max) {
     setColor(H_min, H_max, S_min, S_max, V_min, V_max);
 }
 
+void UColorDetector::addColor(string name, int H_min, int H_max, int S_min, int S_max, int V_min, int V_max) {
+    // Same scale as setColor, all colors are found in one pass
+    boost::lock_guard<boost::mutex> lock(mProcessMutex);
+    mDetector.addColor(name, Scalar(H_min * 180 / 255, S_min, V_min, 0),
+            Scalar(H_max * 180 / 255, S_max, V_max, 0));
+    publishColors();
+}
+
+void UColorDetector::removeColor(string name) {
+    boost::lock_guard<boost::mutex> lock(mProcessMutex);
+    if (!mDetector.removeColor(name))
+        throw std::runtime_error("No color " + name);
+    publishColors();
+}
+
+void UColorDetector::learnHistogram(int left, int top, int width, int height) {
+    // Learned from the next frame, camShift has to be set
+    boost::lock_guard<boost::mutex> lock(mProcessMutex);
+    mDetector.learnHistogram(Rect(left, top, width, height));
+}
+
+void UColorDetector::publishColors() {
+    UList names, visibleList, xList, yList, areaList, blobsList;
+    const vector<ColorDetector::Color>& named = mDetector.colors();
+    const vector<ColorDetector::ColorResult>& results = mDetector.results();
+    for (size_t i = 0; i < named.size(); ++i) {
+        names.push_back(named[i].name);
+        visibleList.push_back(results[i].visible ? 1 : 0);
+        xList.push_back(results[i].position.x);
+        yList.push_back(results[i].position.y);
+        areaList.push_back(results[i].area);
+        blobsList.push_back(blobList(results[i]));
+    }
+    colors = names;
+    colorVisible = visibleList;
+    colorX = xList;
+    colorY = yList;
+    colorArea = areaList;
+    colorBlobs = blobsList;
+}
+
+UList UColorDetector::blobList(const ColorDetector::ColorResult& result) {
+    // Centers in the coordinates of x and y, boxes in image coordinates
+    Size size = mDetector.size();
+    UList list;
+    for (size_t i = 0; i < result.blobs.size(); ++i) {
+        const Blob& blob = result.blobs[i];
+        UList item;
+        item.push_back(cvRound(blob.centroid.x) - size.width / 2);
+        item.push_back(-cvRound(blob.centroid.y) + size.height / 2);
+        item.push_back(blob.area);
+        item.push_back(blob.box.x);
+        item.push_back(blob.box.y);
+        item.push_back(blob.box.width);
+        item.push_back(blob.box.height);
+        list.push_back(item);
+    }
+    return list;
+}
+
 void UColorDetector::changeNotifyImage(UVar& var) {
     // Always unnotify
     mInputImage->unnotify();
-    if (var.as<bool>())
-        UNotifyChange(*mInputImage, &UColorDetector::detectFrom);
+    if (mDescriptor)
+        mDescriptor->unnotify();
+    if (var.as<bool>() && mDispatcher.empty()) {
+        if (mDescriptor)
+            UNotifyChange(*mDescriptor, &UColorDetector::detectFromShm);
+        else
+            UNotifyChange(*mInputImage, &UColorDetector::detectFrom);
+    }
 }
 
 void UColorDetector::changeScale(UVar& newScale) {
@@ -140,136 +365,262 @@ void UColorDetector::changeScale(UVar& newScale) {
     scale = tmp;
 }
 
+void UColorDetector::changeParameters() {
+    boost::lock_guard<boost::mutex> lock(mProcessMutex);
+    mScale = scale.as<double>() > 1.0 ? scale.as<double>() : 1.0;
+    mMinArea = minArea.as<double>();
+    mMaxBlobs = maxBlobs.as<int>() > 1 ? maxBlobs.as<int>() : 1;
+    mTracking = tracking.as<bool>();
+    mFullScanInterval = fullScanInterval.as<int>();
+    mCamShift = camShift.as<bool>();
+}
+
+void UColorDetector::changeInputPolicy() {
+    mMailbox.setPolicy(inputPolicy.as<int>(), queueSize.as<int>() > 0 ? queueSize.as<int>() : 1);
+}
+
 void UColorDetector::detectFrom(UImage src) {
-    // Build MatImage with data from uImage
-    Mat processImage(Size(src.width, src.height), CV_8UC3, src.data);
-
-    // Resize image
-    Mat resizedImage(cvRound(processImage.rows/scale.as<double>()), cvRound(processImage.cols/scale.as<double>()), CV_8UC1);
-    resize(processImage, resizedImage, resizedImage.size(), 0, 0, INTER_LINEAR);
-    width = resizedImage.cols;
-    height = resizedImage.rows;
-    
-    // Copy image to mMatImage as grayscaled image
-    Mat grayscaleImage;
-    cvtColor(resizedImage, grayscaleImage, CV_RGB2GRAY);
-    cvtColor(grayscaleImage, mResultImage, CV_GRAY2RGB);
+    if (src.imageFormat != IMAGE_RGB)
+        throw std::runtime_error("Color detection needs RGB image");
+
+    // Copy data from uImage, the frame is processed later by the processing
+    // thread and the source reuses its buffer
+    FrameMailbox::Frame frame;
+    frame.image = mInputPool.take(Size(src.width, src.height), CV_8UC3);
+    Mat(Size(src.width, src.height), CV_8UC3, src.data).copyTo(frame.image);
+    frame.source = mInputImage->get_name();
+    mMailbox.post(frame);
+}
 
-    // Compute fps - algorithm efficency
-    int64 startTick = getTickCount();
-    fps = static_cast<double>(getTickFrequency()) / (startTick - mLastTick);
-    mLastTick = startTick;
+void UColorDetector::detectFromShm(UVar& descriptor) {
+    // Frame is processed in place, pinned until it is processed or dropped
+    UList list = descriptor.as<UList>();
+    boost::shared_ptr<ShmFrameView> view = mShmInput.acquire(list);
+    if (!view)
+        return;
+    FrameMailbox::Frame frame;
+    frame.image = view->image;
+    frame.source = static_cast<string>(list[0]);
+    frame.id = view->seq;
+    frame.owner = view;
+    mMailbox.post(frame);
+}
+
+void UColorDetector::processThreadFunction() {
+    try {
+        while (true) {
+            FrameMailbox::Frame frame;
+            mMailbox.take(frame);
+            try {
+                processFrame(frame);
+            } catch (std::exception& e) {
+                cerr << "UColorDetector::process(): " << e.what() << endl;
+            }
+            mMailbox.done();
+        }
+    } catch (boost::thread_interrupted&) {
+        return;
+    }
+}
 
-    // Convert From RGB to HSV color space
-    Mat hsvImage;
-    cvtColor(resizedImage, hsvImage, CV_RGB2HSV);
+void UColorDetector::processFrame(const FrameMailbox::Frame& frame) {
+    // Runs on the processing or dispatcher thread, results are published
+    // by update()
+    boost::lock_guard<boost::mutex> lock(mProcessMutex);
+    detect(frame);
+    mResultsPending = true;
+}
 
-    // Find regions
-    Mat thresholdImage;
-    inRange(hsvImage, hsv_min, hsv_max, thresholdImage);
+void UColorDetector::detect(const FrameMailbox::Frame& frame) {
+    mDetector.setScale(mScale);
+    mDetector.setMinArea(mMinArea);
+    mDetector.setMaxBlobs(mMaxBlobs);
+    mDetector.setTracking(mTracking, mFullScanInterval);
+    mDetector.setMode(mCamShift ? COLOR_CAMSHIFT : COLOR_SEGMENTATION);
+    mDetector.process(frame.image, frame.source, frame.id);
 
-    // Filter
-    medianBlur(thresholdImage, thresholdImage, 13);
+    // Compute fps - algorithm efficency
+    int64 tick = getTickCount();
+    mFps = static_cast<double>(getTickFrequency()) / (tick - mLastTick);
+    mLastTick = tick;
+}
 
-    // Add detected region to gray scale image
-    add(mResultImage, resizedImage, mResultImage, thresholdImage);
+int UColorDetector::update() {
+    publishCounters();
+    // A frame being processed is published in one of the next periods,
+    // urbi does not wait for the processing thread
+    if (!mResultsPending)
+        return 0;
+    boost::unique_lock<boost::mutex> lock(mProcessMutex, boost::try_to_lock);
+    if (lock.owns_lock())
+        publishResults();
+    return 0;
+}
 
-    // Compute center of the position 
-    cv::Moments computedMoments(moments(thresholdImage));
-    int xx = static_cast<int>(computedMoments.m10 / computedMoments.m00);
-    int yy = static_cast<int>(computedMoments.m01 / computedMoments.m00);
-    
-    // Finally set visible
-    if ((xx > 0) && (yy > 0)) {
-        // Set point and visible
-        x = xx - processImage.cols / 2;
-        y = -yy + processImage.rows / 2;
-        visible = 1;
-
-        // Draw line from image center to object center
-        line(mResultImage, Point(xx, yy), Point(mResultImage.cols/2, mResultImage.rows/2), Scalar(255, 0, 0), 2);
-    } else {
-        x = 0;
-        y = 0;
-        visible = 0;
+void UColorDetector::publishResults() {
+    mResultsPending = false;
+    {
+        ScopedStage stage(mDetector.times(), STAGE_PUBLISH);
+        publish();
     }
+    if (mDetector.times().enabled())
+        publishStages();
+}
 
-    // Draw horizontal and vertical line in the middle of the image
-    line(mResultImage, Point(0, mResultImage.rows/2), Point(mResultImage.cols, mResultImage.rows/2), Scalar(100, 100, 100), 1);
-    line(mResultImage, Point(mResultImage.cols/2, 0), Point(mResultImage.cols/2, mResultImage.rows), Scalar(100, 100, 100), 1);
-    
-    // Copy mResult image to UImage
-    mBinImage.image.width = mResultImage.cols;
-    mBinImage.image.height = mResultImage.rows;
-    mBinImage.image.size = mResultImage.cols * mResultImage.rows * 3;
-    mBinImage.image.data = mResultImage.data;
+void UColorDetector::publishCounters() {
+    boost::uint64_t counts = mMailbox.received() + mMailbox.processed() + mMailbox.dropped();
+    if (counts == mPublishedCounts)
+        return;
+    mPublishedCounts = counts;
+    received = static_cast<double>(mMailbox.received());
+    processed = static_cast<double>(mMailbox.processed());
+    dropped = static_cast<double>(mMailbox.dropped());
+}
+
+void UColorDetector::changeDispatcher() {
+    if (!mDispatcher.empty())
+        FrameDispatcher::get(mDispatcher).remove(__name);
+    mDispatcher = dispatcher.as<string>();
+
+    // Frames come either from the dispatcher or from own input
+    mInputImage->unnotify();
+    if (mDescriptor)
+        mDescriptor->unnotify();
+    if (!mDispatcher.empty())
+        FrameDispatcher::get(mDispatcher).add(__name, boost::bind(&UColorDetector::processFrame, this, _1));
+    else if (mDescriptor)
+        UNotifyChange(*mDescriptor, &UColorDetector::detectFromShm);
+    else
+        UNotifyChange(*mInputImage, &UColorDetector::detectFrom);
+}
+
+void UColorDetector::publish() {
+    const Mat& resultImage = mDetector.result();
+    width = resultImage.cols;
+    height = resultImage.rows;
+
+    fps = mFps;
+
+    x = mDetector.position().x;
+    y = mDetector.position().y;
+    visible = mDetector.visible() ? 1 : 0;
+    blobs = blobList(mDetector.result0());
+    processedFraction = mDetector.processedFraction();
+    if (mDetector.mode() == COLOR_CAMSHIFT) {
+        angle = mDetector.trackedBox().angle;
+        boxWidth = mDetector.trackedBox().size.width;
+        boxHeight = mDetector.trackedBox().size.height;
+    }
+    if (!mDetector.colors().empty())
+        publishColors();
+
+    // Copy result image to UImage
+    mBinImage.image.width = resultImage.cols;
+    mBinImage.image.height = resultImage.rows;
+    mBinImage.image.size = resultImage.cols * resultImage.rows * 3;
+    mBinImage.image.data = resultImage.data;
     image = mBinImage;
+
+    allocations = static_cast<double>(mDetector.allocations() + mInputPool.allocations());
 }
 
-void UColorDetector::SetImage(UImage src) {
-    // Build MatImage with data from uImage
-    Mat processImage(Size(src.width, src.height), CV_8UC3, src.data);
-
-    // Resize image
-    Mat resizedImage(cvRound(processImage.rows/scale.as<double>()), cvRound(processImage.cols/scale.as<double>()), CV_8UC1);
-    resize(processImage, resizedImage, resizedImage.size(), 0, 0, INTER_LINEAR);
-    width = resizedImage.cols;
-    height = resizedImage.rows;
-    
-    // Copy image to mMatImage as grayscaled image
-    Mat grayscaleImage;
-    cvtColor(resizedImage, grayscaleImage, CV_RGB2GRAY);
-    cvtColor(grayscaleImage, mResultImage, CV_GRAY2RGB);
+void UColorDetector::publishStages() {
+    // Rolling averages of the measured stages
+    UList list;
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        if (mDetector.times().average(i) > 0) {
+            UList item;
+            item.push_back(string(stageName(i)));
+            item.push_back(mDetector.times().average(i));
+            list.push_back(item);
+        }
+    }
+    stages = list;
+}
 
-    // Compute fps - algorithm efficency
-    int64 startTick = getTickCount();
-    fps = static_cast<double>(getTickFrequency()) / (startTick - mLastTick);
-    mLastTick = startTick;
+void UColorDetector::changeTrace(UVar& var) {
+    mDetector.times().enable(var.as<bool>());
+}
 
-    // Convert From RGB to HSV color space
-    Mat hsvImage;
-    cvtColor(resizedImage, hsvImage, CV_RGB2HSV);
+void UColorDetector::changeClassifier(UVar&) {
+    // Table is built in the background, HSV thresholds are used until then
+    boost::lock_guard<boost::mutex> lock(mProcessMutex);
+    mDetector.setClassifier(classifier.as<int>(), tableBits.as<int>());
+}
 
-    // Find regions
-    Mat thresholdImage;
-    inRange(hsvImage, hsv_min, hsv_max, thresholdImage);
+void UColorDetector::dumpTrace(string file) {
+    ofstream out(file.c_str());
+    writeStageTrace(out);
+    if (!out)
+        throw std::runtime_error("Could not write trace " + file);
+}
 
-    // Filter
-    medianBlur(thresholdImage, thresholdImage, 13);
+UList UColorDetector::processVideo(string path) {
+    BatchReader reader(path);
+    return processFrames(reader);
+}
 
-    // Add detected region to gray scale image
-    add(mResultImage, resizedImage, mResultImage, thresholdImage);
+UList UColorDetector::processBatch(UList files) {
+    vector<string> paths;
+    for (size_t i = 0; i < files.size(); ++i)
+        paths.push_back(static_cast<string>(files[i]));
+    BatchReader reader(paths);
+    return processFrames(reader);
+}
 
-    // Compute center of the position 
-    cv::Moments computedMoments(moments(thresholdImage));
-    int xx = static_cast<int>(computedMoments.m10 / computedMoments.m00);
-    int yy = static_cast<int>(computedMoments.m01 / computedMoments.m00);
-    
-    // Finally set visible
-    if ((xx > 0) && (yy > 0)) {
-        // Set point and visible
-        x = xx - processImage.cols / 2;
-        y = -yy + processImage.rows / 2;
-        visible = 1;
-
-        // Draw line from image center to object center
-        line(mResultImage, Point(xx, yy), Point(mResultImage.cols/2, mResultImage.rows/2), Scalar(255, 0, 0), 2);
-    } else {
-        x = 0;
-        y = 0;
-        visible = 0;
+UList UColorDetector::processFrames(BatchReader& reader) {
+    boost::lock_guard<boost::mutex> batchLock(mBatchMutex);
+
+    // Own detector with the current parameters, so live frames keep being
+    // processed meanwhile
+    ColorDetector detector;
+    {
+        boost::lock_guard<boost::mutex> lock(mProcessMutex);
+        detector.setColor(mDetector.hsvMin(), mDetector.hsvMax());
+        detector.setColors(mDetector.colors());
+        detector.setClassifier(mDetector.classifier(), mDetector.tableBits());
+    }
+    detector.setScale(scale.as<double>());
+    detector.setMinArea(minArea.as<double>());
+    detector.setMaxBlobs(maxBlobs.as<int>() > 1 ? maxBlobs.as<int>() : 1);
+    detector.setTracking(tracking.as<bool>(), fullScanInterval.as<int>());
+    detector.setMode(camShift.as<bool>() ? COLOR_CAMSHIFT : COLOR_SEGMENTATION);
+    detector.times().setOwner(__name + ".batch");
+    detector.times().enable(trace.as<bool>());
+
+    // Frames are decoded on another thread while this one detects
+    UList visibleList, xList, yList;
+    Mat frame;
+    double timestamp;
+    boost::uint64_t id = 0;
+    while (reader.next(frame, timestamp)) {
+        detector.process(frame, __name + ".batch", ++id);
+        visibleList.push_back(detector.visible() ? 1 : 0);
+        xList.push_back(detector.position().x);
+        yList.push_back(detector.position().y);
     }
 
-    // Draw horizontal and vertical line in the middle of the image
-    line(mResultImage, Point(0, mResultImage.rows/2), Point(mResultImage.cols, mResultImage.rows/2), Scalar(100, 100, 100), 1);
-    line(mResultImage, Point(mResultImage.cols/2, 0), Point(mResultImage.cols/2, mResultImage.rows), Scalar(100, 100, 100), 1);
-    
-    // Copy mResult image to UImage
-    mBinImage.image.width = mResultImage.cols;
-    mBinImage.image.height = mResultImage.rows;
-    mBinImage.image.size = mResultImage.cols * mResultImage.rows * 3;
-    mBinImage.image.data = mResultImage.data;
-    image = mBinImage;
+    // [visible, x, y], one element per frame in each
+    UList result;
+    result.push_back(visibleList);
+    result.push_back(xList);
+    result.push_back(yList);
+    return result;
+}
+
+void UColorDetector::SetImage(UImage src) {
+    if (src.imageFormat != IMAGE_RGB)
+        throw std::runtime_error("Color detection needs RGB image");
+
+    // Processed right away, results are set when SetImage returns
+    FrameMailbox::Frame frame;
+    frame.image = mInputPool.take(Size(src.width, src.height), CV_8UC3);
+    Mat(Size(src.width, src.height), CV_8UC3, src.data).copyTo(frame.image);
+    frame.source = mInputImage->get_name();
+
+    boost::lock_guard<boost::mutex> lock(mProcessMutex);
+    detect(frame);
+    publishResults();
 }
 
 UStart(UColorDetector);
@@ -0,0 +1,223 @@
+/*******************************************
+ *
+ *	UDispatcher v1.0
+ *   Feeds every new frame of a source to all detectors
+ *   registered with it at once, on a pool with one thread
+ *   per core, and waits for all of them before taking the
+ *   next frame. Detectors join by setting their dispatcher
+ *   variable to the name of this object.
+ *	Compiled with OpenCV 2.2
+ *
+ ********************************************/
+
+#include <urbi/uobject.hh>
+
+#include <cv.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "framedispatcher.h"
+#include "framemailbox.h"
+#include "shminput.h"
+#include "workstealingpool.h"
+
+using namespace cv;
+using namespace urbi;
+using namespace std;
+
+class UDispatcher : public UObject {
+public:
+    UDispatcher(const string&);
+    ~UDispatcher();
+
+    int init(UVar& sourceImage);
+    int attach(UVar& descriptor); // read frames from UCamera shared memory
+
+    virtual int update(); // publishes results of the dispatch thread
+
+private:
+    void changeNotifyImage(UVar&);
+    void detectFrom(UImage); // new frame of the source
+    void detectFromShm(UVar&); // new shared memory frame of the source
+    void dispatchThreadFunction();
+    void publishCounters();
+
+    // Results
+    UVar detectors; // names of registered detectors
+    UVar threads; // number of pool threads
+    UVar makespan; // time until the last detector finished the last frame [ms]
+    UVar busy; // [[detector, time [ms]], ...] of the last frame
+    UVar received; // frames received from the source
+    UVar processed; // frames dispatched
+    UVar dropped; // frames replaced by a newer one before dispatch
+    // Parameters
+    UVar notifyImage;
+
+    UVar *mInputImage;
+    UVar *mDescriptor;
+    ShmFrameInput mShmInput;
+    FrameMailbox mMailbox; // the newest frame only
+    boost::thread mDispatchThread;
+
+    // Urbi variables are set only on the urbi side, results of the dispatch
+    // thread are published by update()
+    static const int PUBLISH_PERIOD_MS = 10;
+    boost::mutex mResultsMutex;
+    vector<string> mDetectors;
+    vector<pair<string, double> > mBusy;
+    double mMakespan;
+    boost::atomic<bool> mResultsPending; // dispatched frame not published yet
+    boost::uint64_t mPublishedCounts; // sum of mailbox counters last published
+};
+
+UDispatcher::UDispatcher(const string& s) : urbi::UObject(s), mInputImage(0), mDescriptor(0) {
+    UBindFunction(UDispatcher, init);
+}
+
+UDispatcher::~UDispatcher() {
+    mMailbox.close();
+    mDispatchThread.interrupt();
+    mDispatchThread.join();
+
+    if(mInputImage)
+        delete mInputImage;
+    if(mDescriptor)
+        delete mDescriptor;
+}
+
+int UDispatcher::init(UVar& sourceImage) {
+    // Bind all urbi variables
+    UBindVars(UDispatcher, detectors, threads, makespan, busy, received, processed, dropped, notifyImage);
+
+    // Bind functions
+    UBindFunction(UDispatcher, attach);
+
+    detectors = UList();
+    threads = static_cast<int>(FrameDispatcher::pool().size());
+    makespan = 0;
+    busy = UList();
+    received = 0;
+    processed = 0;
+    dropped = 0;
+    notifyImage = 1;
+    mMakespan = 0;
+    mResultsPending = false;
+    mPublishedCounts = 0;
+
+    mInputImage = new UVar(sourceImage);
+    UNotifyChange(*mInputImage, &UDispatcher::detectFrom);
+    UNotifyChange(notifyImage, &UDispatcher::changeNotifyImage);
+    USetUpdate(PUBLISH_PERIOD_MS);
+
+    mDispatchThread = boost::thread(&UDispatcher::dispatchThreadFunction, this);
+
+    return 0;
+}
+
+int UDispatcher::attach(UVar& descriptor) {
+    // Frames come from shared memory instead of the image variable
+    mInputImage->unnotify();
+    if(mDescriptor)
+        delete mDescriptor;
+    mDescriptor = new UVar(descriptor);
+    UNotifyChange(*mDescriptor, &UDispatcher::detectFromShm);
+
+    return 0;
+}
+
+void UDispatcher::changeNotifyImage(UVar& var) {
+    // Always unnotify
+    mInputImage->unnotify();
+    if (mDescriptor)
+        mDescriptor->unnotify();
+    if (var.as<bool>()) {
+        if (mDescriptor)
+            UNotifyChange(*mDescriptor, &UDispatcher::detectFromShm);
+        else
+            UNotifyChange(*mInputImage, &UDispatcher::detectFrom);
+    }
+}
+
+void UDispatcher::detectFrom(UImage src) {
+    // Copy data from uImage, the source reuses its buffer
+    FrameMailbox::Frame frame;
+    frame.image = Mat(Size(src.width, src.height), src.imageFormat == IMAGE_GREY8 ? CV_8UC1 : CV_8UC3, src.data).clone();
+    frame.source = mInputImage->get_name();
+    mMailbox.post(frame);
+}
+
+void UDispatcher::detectFromShm(UVar& descriptor) {
+    // Frame is pinned until all detectors are done with it
+    UList list = descriptor.as<UList>();
+    boost::shared_ptr<ShmFrameView> view = mShmInput.acquire(list);
+    if (!view)
+        return;
+    FrameMailbox::Frame frame;
+    frame.image = view->image;
+    frame.source = static_cast<string>(list[0]);
+    frame.id = view->seq;
+    frame.owner = view;
+    mMailbox.post(frame);
+}
+
+void UDispatcher::dispatchThreadFunction() {
+    FrameDispatcher& dispatcher = FrameDispatcher::get(__name);
+    try {
+        while (true) {
+            FrameMailbox::Frame frame;
+            mMailbox.take(frame);
+            dispatcher.dispatch(frame);
+            mMailbox.done();
+
+            boost::lock_guard<boost::mutex> lock(mResultsMutex);
+            mDetectors = dispatcher.detectors();
+            mBusy = dispatcher.busy();
+            mMakespan = dispatcher.makespan();
+            mResultsPending = true;
+        }
+    } catch (boost::thread_interrupted&) {
+        return;
+    }
+}
+
+int UDispatcher::update() {
+    publishCounters();
+    if (!mResultsPending.exchange(false))
+        return 0;
+
+    UList names, times;
+    double lastMakespan;
+    {
+        boost::lock_guard<boost::mutex> lock(mResultsMutex);
+        for (size_t i = 0; i < mDetectors.size(); ++i)
+            names.push_back(mDetectors[i]);
+        for (size_t i = 0; i < mBusy.size(); ++i) {
+            UList item;
+            item.push_back(mBusy[i].first);
+            item.push_back(mBusy[i].second);
+            times.push_back(item);
+        }
+        lastMakespan = mMakespan;
+    }
+    detectors = names;
+    busy = times;
+    makespan = lastMakespan;
+    return 0;
+}
+
+void UDispatcher::publishCounters() {
+    boost::uint64_t counts = mMailbox.received() + mMailbox.processed() + mMailbox.dropped();
+    if (counts == mPublishedCounts)
+        return;
+    mPublishedCounts = counts;
+    received = static_cast<double>(mMailbox.received());
+    processed = static_cast<double>(mMailbox.processed());
+    dropped = static_cast<double>(mMailbox.dropped());
+}
+
+UStart(UDispatcher);
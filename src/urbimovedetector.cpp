@@ -27,10 +27,21 @@
 
 #include <vector>
 
-#include <boost/circular_buffer.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
+#include <fstream>
 #include <iostream>
 
+#include "batchreader.h"
+#include "framedispatcher.h"
+#include "framemailbox.h"
+#include "movedetector.h"
+#include "scratchpool.h"
+#include "shminput.h"
+#include "stagetimer.h"
+
 using namespace cv;
 using namespace std;
 using namespace urbi;
@@ -42,21 +53,52 @@ public:
 	~UMoveDetector();
 
 	int init(UVar& sourceImage);
+	int attach(UVar& descriptor); // read frames from UCamera shared memory
+
+	virtual int update(); // publishes frames processed by other threads
 
 private:
 	void changeNotifyImage(UVar&);
 	void changeScale(UVar&); // change scale function
+	void changeParameters(); // copies processing parameters for detect()
 	void changeImageBufferSize(UVar&);
+	void changeInputPolicy();
+	void changeDispatcher();
 	void detectFrom(UImage); // image processing function
+	void detectFromShm(UVar&); // image processing of shared memory frame
 	void SetImage(UImage);
-
-	// Temporary variables for image processing function
-	Mat mResultImage;
-	Mat mMHI;
+	void publish(); // results of mDetector to urbi variables
+	void publishStages(); // stage timing to urbi variables
+	void changeTrace(UVar&);
+	void dumpTrace(string); // writes Chrome trace JSON of all detectors
+	UList processVideo(string path); // results of every frame of a video or recording
+	UList processBatch(UList files); // results of every image file
+	UList processFrames(BatchReader& reader);
+	void processThreadFunction(); // processes frames from mMailbox
+	void processFrame(const FrameMailbox::Frame&); // called by both threads
+	void detect(const FrameMailbox::Frame&); // mProcessMutex held
+	void publishResults(); // results of the last frame, mProcessMutex held
+	void publishCounters();
+
+	MoveDetector mDetector; // image processing
 
 	int64 mLastTick;
-
-	circular_buffer<Mat> mImageBuffer;
+	double mFps;
+
+	// Processing parameters, copied from urbi variables on the urbi side as
+	// detect() runs on other threads, mProcessMutex held
+	double mScale;
+	int mBufferSize;
+	double mDuration;
+	double mDiffThreshold;
+	int mSmooth;
+	bool mReady; // the last frame gave a result, mProcessMutex held
+
+	// Urbi variables are set only on the urbi side, frames processed by
+	// other threads are published by update()
+	static const int PUBLISH_PERIOD_MS = 10;
+	boost::atomic<bool> mResultsPending; // processed frame not published yet
+	boost::uint64_t mPublishedCounts; // sum of mailbox counters last published
 
 	UVar visible; // if object is visible
 	UVar x; // position in x of the object center
@@ -74,31 +116,62 @@ private:
 	UVar imageBufferSize;
 	UVar diffThreshold; // difference betwen two frames treshold
 	UVar smooth; // smooth filter parameter
+	UVar inputPolicy; // 0 - newest frame only, 1 - queue of queueSize frames, 2 - source waits
+	UVar queueSize;
+	UVar dispatcher; // name of UDispatcher feeding frames, empty - own input
+	UVar received; // frames received from the source
+	UVar processed; // frames processed
+	UVar dropped; // frames dropped by the input policy
+	UVar allocations; // image buffers allocated so far, grows only when size changes
+	UVar trace; // measure processing stages
+	UVar stages; // [stage, average ms] pairs, updated while tracing
 
 	UVar image;
 	UVar *mInputImage;
+	UVar *mDescriptor;
+	ShmFrameInput mShmInput;
+	ScratchPool mInputPool; // copies of input frames waiting in mMailbox
+	FrameMailbox mMailbox; // frames waiting for processing
+	boost::thread mProcessThread;
+	boost::mutex mProcessMutex; // mDetector is used by one thread at a time
+	string mDispatcher; // registered with this dispatcher
+	boost::mutex mBatchMutex; // one batch at a time
 	UBinary mBinImage;
 };
 
 UMoveDetector::UMoveDetector(const std::string& s) :
-		UObject(s) {
+		UObject(s), mInputImage(0), mDescriptor(0) {
 	UBindFunction(UMoveDetector, init);
 }
 
 UMoveDetector::~UMoveDetector() {
+	if (!mDispatcher.empty())
+		FrameDispatcher::get(mDispatcher).remove(__name);
+	mMailbox.close();
+	mProcessThread.interrupt();
+	mProcessThread.join();
+
 	// Prevent of double free error
-	if (mBinImage.image.data == mResultImage.data)
+	if (mBinImage.image.data == mDetector.result().data)
 		mBinImage.image.data = 0;
 
 	if (mInputImage)
 		delete mInputImage;
+	if (mDescriptor)
+		delete mDescriptor;
 }
 
 void UMoveDetector::changeNotifyImage(UVar& var) {
 	// Always unnotify
 	mInputImage->unnotify();
-	if (var.as<bool>())
-		UNotifyChange(*mInputImage, &UMoveDetector::detectFrom);
+	if (mDescriptor)
+		mDescriptor->unnotify();
+	if (var.as<bool>() && mDispatcher.empty()) {
+		if (mDescriptor)
+			UNotifyChange(*mDescriptor, &UMoveDetector::detectFromShm);
+		else
+			UNotifyChange(*mInputImage, &UMoveDetector::detectFrom);
+	}
 	mode = var.as<bool>();
 	notifyImage = var.as<bool>();
 }
@@ -108,10 +181,16 @@ int UMoveDetector::init(UVar& sourceImage) {
 	UBindVars(
 			UMoveDetector,
 			scale, fps, width, height, visible, x, y, notifyImage, mode, image, duration, frameBuffer, imageBufferSize, diffThreshold, smooth, time);
+	UBindVars(UMoveDetector, inputPolicy, queueSize, dispatcher, received, processed, dropped);
+	UBindVars(UMoveDetector, allocations, trace, stages);
 
 	// Bind functions
 	UBindThreadedFunction(UMoveDetector, detectFrom, LOCK_INSTANCE);
 	UBindThreadedFunction(UMoveDetector, SetImage, LOCK_INSTANCE);
+	UBindFunction(UMoveDetector, attach);
+	UBindFunction(UMoveDetector, dumpTrace);
+	UBindThreadedFunction(UMoveDetector, processVideo, LOCK_FUNCTION);
+	UBindThreadedFunction(UMoveDetector, processBatch, LOCK_FUNCTION);
 
 	mBinImage.type = BINARY_IMAGE;
 	mBinImage.image.imageFormat = IMAGE_RGB;
@@ -126,9 +205,23 @@ int UMoveDetector::init(UVar& sourceImage) {
 
 	duration = 1; // time window for analysis (in seconds)
 	frameBuffer = 2; // number of cyclic frame buffer used for motion detection
-	mImageBuffer.resize(frameBuffer.as<int>());
 	diffThreshold = 30; // difference betwen two frames treshold
 	smooth = 31; // smooth filter parameter
+	inputPolicy = MAILBOX_COALESCE;
+	queueSize = 2;
+	dispatcher = "";
+	received = 0;
+	processed = 0;
+	dropped = 0;
+	allocations = 0;
+	trace = 0;
+	stages = UList();
+	mDetector.times().setOwner(__name);
+	mLastTick = getTickCount();
+	mFps = 0;
+	mReady = false;
+	mResultsPending = false;
+	mPublishedCounts = 0;
 
 	mInputImage = new UVar(sourceImage);
 
@@ -139,6 +232,31 @@ int UMoveDetector::init(UVar& sourceImage) {
 	UNotifyChange(scale, &UMoveDetector::changeScale);
 	UNotifyChange(frameBuffer, &UMoveDetector::changeImageBufferSize);
 	UNotifyChange(imageBufferSize, &UMoveDetector::changeImageBufferSize);
+	UNotifyChange(inputPolicy, &UMoveDetector::changeInputPolicy);
+	UNotifyChange(queueSize, &UMoveDetector::changeInputPolicy);
+	UNotifyChange(dispatcher, &UMoveDetector::changeDispatcher);
+	UNotifyChange(trace, &UMoveDetector::changeTrace);
+	UNotifyChange(scale, &UMoveDetector::changeParameters);
+	UNotifyChange(frameBuffer, &UMoveDetector::changeParameters);
+	UNotifyChange(duration, &UMoveDetector::changeParameters);
+	UNotifyChange(diffThreshold, &UMoveDetector::changeParameters);
+	UNotifyChange(smooth, &UMoveDetector::changeParameters);
+	changeParameters();
+	USetUpdate(PUBLISH_PERIOD_MS);
+
+	// Start processing thread
+	mProcessThread = boost::thread(&UMoveDetector::processThreadFunction, this);
+
+	return 0;
+}
+
+int UMoveDetector::attach(UVar& descriptor) {
+	// Frames come from shared memory instead of the image variable
+	mInputImage->unnotify();
+	if (mDescriptor)
+		delete mDescriptor;
+	mDescriptor = new UVar(descriptor);
+	UNotifyChange(*mDescriptor, &UMoveDetector::detectFromShm);
 
 	return 0;
 }
@@ -147,7 +265,6 @@ void UMoveDetector::changeScale(UVar& newScale) {
 	double tmp = newScale.as<double>();
 	tmp = tmp > 1.0 ? tmp : 1.0;
 	scale = tmp;
-	mImageBuffer.clear();
 }
 
 void UMoveDetector::changeImageBufferSize(UVar& newBufferSize) {
@@ -155,96 +272,249 @@ void UMoveDetector::changeImageBufferSize(UVar& newBufferSize) {
 	tmp = tmp > 0 ? tmp : 1;
 	imageBufferSize = tmp;
 	frameBuffer = tmp;
-	mImageBuffer.resize(tmp);
-	mImageBuffer.clear();
 	return;
 }
 
+void UMoveDetector::changeParameters() {
+	lock_guard<boost::mutex> lock(mProcessMutex);
+	mScale = scale.as<double>() > 1.0 ? scale.as<double>() : 1.0;
+	mBufferSize = frameBuffer.as<int>() > 0 ? frameBuffer.as<int>() : 1;
+	mDuration = duration.as<double>();
+	mDiffThreshold = diffThreshold.as<double>();
+	mSmooth = smooth.as<int>();
+}
+
+void UMoveDetector::changeInputPolicy() {
+	mMailbox.setPolicy(inputPolicy.as<int>(),
+			queueSize.as<int>() > 0 ? queueSize.as<int>() : 1);
+}
+
 void UMoveDetector::detectFrom(UImage sourceImage) {
-	// Build MatImage with data from uImage
-	Mat processImage(Size(sourceImage.width, sourceImage.height), CV_8UC3,
-			sourceImage.data);
-
-	//Resize image
-	Mat resizedImage(cvRound(processImage.rows / scale.as<double>()),
-			cvRound(processImage.cols / scale.as<double>()), CV_8UC1);
-	resize(processImage, resizedImage, resizedImage.size(), 0, 0, INTER_LINEAR);
-	width = resizedImage.cols;
-	height = resizedImage.rows;
-
-	if (resizedImage.size() != mMHI.size()) {
-		mMHI = Mat::zeros(resizedImage.size(), CV_32F);
+	// Copy data from uImage, the frame is processed later by the processing
+	// thread and the source reuses its buffer. Grayscale images are taken
+	// as is.
+	Size size(sourceImage.width, sourceImage.height);
+	int type = sourceImage.imageFormat == IMAGE_GREY8 ? CV_8UC1 : CV_8UC3;
+	FrameMailbox::Frame frame;
+	frame.image = mInputPool.take(size, type);
+	Mat(size, type, sourceImage.data).copyTo(frame.image);
+	frame.source = mInputImage->get_name();
+	mMailbox.post(frame);
+}
+
+void UMoveDetector::detectFromShm(UVar& descriptor) {
+	// Frame is processed in place, pinned until it is processed or dropped
+	UList list = descriptor.as<UList>();
+	boost::shared_ptr<ShmFrameView> view = mShmInput.acquire(list);
+	if (!view)
+		return;
+	FrameMailbox::Frame frame;
+	frame.image = view->image;
+	frame.source = static_cast<string>(list[0]);
+	frame.id = view->seq;
+	frame.owner = view;
+	mMailbox.post(frame);
+}
+
+void UMoveDetector::processThreadFunction() {
+	try {
+		while (true) {
+			FrameMailbox::Frame frame;
+			mMailbox.take(frame);
+			try {
+				processFrame(frame);
+			} catch (std::exception& e) {
+				cerr << "UMoveDetector::process(): " << e.what() << endl;
+			}
+			mMailbox.done();
+		}
+	} catch (thread_interrupted&) {
+		return;
 	}
+}
 
-	// Copy image to mMatImage as grayscaled image
-	Mat grayscaleImage;
-	cvtColor(resizedImage, grayscaleImage, CV_RGB2GRAY);
-	cvtColor(grayscaleImage, mResultImage, CV_GRAY2RGB);
-	mImageBuffer.push_back(grayscaleImage);
+void UMoveDetector::processFrame(const FrameMailbox::Frame& frame) {
+	// Runs on the processing or dispatcher thread, results are published
+	// by update()
+	lock_guard<boost::mutex> lock(mProcessMutex);
+	detect(frame);
+	mResultsPending = true;
+}
 
-	if (!mImageBuffer.full())
+void UMoveDetector::detect(const FrameMailbox::Frame& frame) {
+	// Detector restarts by itself when scale or buffer size change
+	mDetector.setScale(mScale);
+	mDetector.setBufferSize(mBufferSize);
+	mDetector.setDuration(mDuration);
+	mDetector.setDiffThreshold(mDiffThreshold);
+	mDetector.setSmooth(mSmooth);
+	mReady = mDetector.process(frame.image, frame.source, frame.id);
+	if (!mReady)
 		return;
 
 	//Compute fps - algorithm efficency
-	int64 startTick = getTickCount();
-	fps = static_cast<double>(getTickFrequency()) / (startTick - mLastTick);
-	mLastTick = startTick;
-	double timestamp = (double) mLastTick / getTickFrequency();
-
-	Mat silh;
-	absdiff(mImageBuffer.front(), mImageBuffer.back(), silh);
-	threshold(silh, silh, diffThreshold.as<double>(), 1, CV_THRESH_BINARY);
-	updateMotionHistory(silh, mMHI, timestamp, duration.as<double>());
-
-	Mat thresholdImage;
-	mMHI.convertTo(thresholdImage, CV_8U, 255. / duration.as<double>(),
-			(duration.as<double>() - timestamp) * 255. / duration.as<double>());
-	threshold(thresholdImage, thresholdImage, 1, 255, CV_THRESH_BINARY);
-	medianBlur(thresholdImage, thresholdImage, smooth.as<int>());
-
-	Mat_<Vec3b> greenImage(thresholdImage.size(), Vec3b(255,0,0));
-	add(greenImage, mResultImage, mResultImage, thresholdImage);
-
-	// Compute center of the position
-	cv::Moments computedMoments(moments(thresholdImage));
-	int xx = static_cast<int>(computedMoments.m10 / computedMoments.m00);
-	int yy = static_cast<int>(computedMoments.m01 / computedMoments.m00);
-
-	// Finally set visible
-	if ((xx > 0) && (yy > 0)) {
-		// Set point and visible
-		x = xx - processImage.cols / 2;
-		y = -yy + processImage.rows / 2;
-		visible = 1;
-
-		// Draw line from image center to object center
-		line(mResultImage, Point(xx, yy),
-				Point(mResultImage.cols / 2, mResultImage.rows / 2),
-				Scalar(255, 0, 0), 2);
-	} else {
-		x = 0;
-		y = 0;
-		visible = 0;
+	int64 tick = getTickCount();
+	mFps = static_cast<double>(getTickFrequency()) / (tick - mLastTick);
+	mLastTick = tick;
+}
+
+int UMoveDetector::update() {
+	publishCounters();
+	// A frame being processed is published in one of the next periods,
+	// urbi does not wait for the processing thread
+	if (!mResultsPending)
+		return 0;
+	unique_lock<boost::mutex> lock(mProcessMutex, try_to_lock);
+	if (lock.owns_lock())
+		publishResults();
+	return 0;
+}
+
+void UMoveDetector::publishResults() {
+	mResultsPending = false;
+	width = mDetector.size().width;
+	height = mDetector.size().height;
+	if (!mReady)
+		return;
+	{
+		ScopedStage stage(mDetector.times(), STAGE_PUBLISH);
+		publish();
 	}
+	if (mDetector.times().enabled())
+		publishStages();
+}
+
+void UMoveDetector::publishCounters() {
+	boost::uint64_t counts = mMailbox.received() + mMailbox.processed() + mMailbox.dropped();
+	if (counts == mPublishedCounts)
+		return;
+	mPublishedCounts = counts;
+	received = static_cast<double>(mMailbox.received());
+	processed = static_cast<double>(mMailbox.processed());
+	dropped = static_cast<double>(mMailbox.dropped());
+}
+
+void UMoveDetector::changeDispatcher() {
+	if (!mDispatcher.empty())
+		FrameDispatcher::get(mDispatcher).remove(__name);
+	mDispatcher = dispatcher.as<string>();
+
+	// Frames come either from the dispatcher or from own input
+	mInputImage->unnotify();
+	if (mDescriptor)
+		mDescriptor->unnotify();
+	if (!mDispatcher.empty())
+		FrameDispatcher::get(mDispatcher).add(__name,
+				boost::bind(&UMoveDetector::processFrame, this, _1));
+	else if (mDescriptor)
+		UNotifyChange(*mDescriptor, &UMoveDetector::detectFromShm);
+	else
+		UNotifyChange(*mInputImage, &UMoveDetector::detectFrom);
+}
+
+void UMoveDetector::publish() {
+	fps = mFps;
 
-	// Draw horizontal and vertical line in the middle of the image
-	line(mResultImage, Point(0, mResultImage.rows / 2),
-			Point(mResultImage.cols, mResultImage.rows / 2),
-			Scalar(100, 100, 100), 1);
-	line(mResultImage, Point(mResultImage.cols / 2, 0),
-			Point(mResultImage.cols / 2, mResultImage.rows),
-			Scalar(100, 100, 100), 1);
-
-	// Copy mResult image to UImage
-	mBinImage.image.width = mResultImage.cols;
-	mBinImage.image.height = mResultImage.rows;
-	mBinImage.image.size = mResultImage.cols * mResultImage.rows * 3;
-	mBinImage.image.data = mResultImage.data;
+	x = mDetector.position().x;
+	y = mDetector.position().y;
+	visible = mDetector.visible() ? 1 : 0;
+
+	// Copy result image to UImage
+	const Mat& resultImage = mDetector.result();
+	mBinImage.image.width = resultImage.cols;
+	mBinImage.image.height = resultImage.rows;
+	mBinImage.image.size = resultImage.cols * resultImage.rows * 3;
+	mBinImage.image.data = resultImage.data;
 	image = mBinImage;
+
+	allocations = static_cast<double>(mDetector.allocations() + mInputPool.allocations());
+}
+
+void UMoveDetector::publishStages() {
+	// Rolling averages of the measured stages
+	UList list;
+	for (int i = 0; i < STAGE_COUNT; ++i) {
+		if (mDetector.times().average(i) > 0) {
+			UList item;
+			item.push_back(string(stageName(i)));
+			item.push_back(mDetector.times().average(i));
+			list.push_back(item);
+		}
+	}
+	stages = list;
+}
+
+void UMoveDetector::changeTrace(UVar& var) {
+	mDetector.times().enable(var.as<bool>());
+}
+
+void UMoveDetector::dumpTrace(string file) {
+	ofstream out(file.c_str());
+	writeStageTrace(out);
+	if (!out)
+		throw std::runtime_error("Could not write trace " + file);
+}
+
+UList UMoveDetector::processVideo(string path) {
+	BatchReader reader(path);
+	return processFrames(reader);
+}
+
+UList UMoveDetector::processBatch(UList files) {
+	vector<string> paths;
+	for (size_t i = 0; i < files.size(); ++i)
+		paths.push_back(static_cast<string>(files[i]));
+	BatchReader reader(paths);
+	return processFrames(reader);
+}
+
+UList UMoveDetector::processFrames(BatchReader& reader) {
+	lock_guard<boost::mutex> batchLock(mBatchMutex);
+
+	// Own detector with the current parameters, so live frames keep being
+	// processed meanwhile
+	MoveDetector detector;
+	detector.setScale(scale.as<double>());
+	detector.setBufferSize(frameBuffer.as<int>());
+	detector.setDuration(duration.as<double>());
+	detector.setDiffThreshold(diffThreshold.as<double>());
+	detector.setSmooth(smooth.as<int>());
+	detector.times().setOwner(__name + ".batch");
+	detector.times().enable(trace.as<bool>());
+
+	// Frames are decoded on another thread while this one detects. Motion
+	// history follows the frame timestamps, not the processing time.
+	UList visibleList, xList, yList;
+	Mat frame;
+	double timestamp;
+	boost::uint64_t id = 0;
+	while (reader.next(frame, timestamp)) {
+		bool ready = detector.process(frame, __name + ".batch", ++id, timestamp);
+		visibleList.push_back(ready && detector.visible() ? 1 : 0);
+		xList.push_back(ready ? detector.position().x : 0);
+		yList.push_back(ready ? detector.position().y : 0);
+	}
+
+	// [visible, x, y], one element per frame in each
+	UList result;
+	result.push_back(visibleList);
+	result.push_back(xList);
+	result.push_back(yList);
+	return result;
 }
 
 void UMoveDetector::SetImage(UImage src) {
-	detectFrom(src);
+	// Processed right away, results are set when SetImage returns
+	Size size(src.width, src.height);
+	int type = src.imageFormat == IMAGE_GREY8 ? CV_8UC1 : CV_8UC3;
+	FrameMailbox::Frame frame;
+	frame.image = mInputPool.take(size, type);
+	Mat(size, type, src.data).copyTo(frame.image);
+	frame.source = mInputImage->get_name();
+
+	lock_guard<boost::mutex> lock(mProcessMutex);
+	detect(frame);
+	publishResults();
 }
 
 UStart(UMoveDetector);
@@ -13,10 +13,23 @@
 #include <cv.h>
 #include <highgui.h>
 
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <vector>
 
+#include "batchreader.h"
+#include "framedispatcher.h"
+#include "framemailbox.h"
+#include "objectdetector.h"
+#include "scratchpool.h"
+#include "shminput.h"
+#include "stagetimer.h"
+
 using namespace cv;
 using namespace urbi;
 using namespace std;
@@ -27,18 +40,50 @@ public:
     ~UObjectDetector();
     
     int init(UVar& sourceImage);
+    int attach(UVar& descriptor); // read frames from UCamera shared memory
+
+    virtual int update(); // publishes frames processed by other threads
     
 private:
-    cv::CascadeClassifier mCVCascade;
-    Mat mResultImage;
+    ObjectDetector mDetector; // image processing
     int64 mLastTick;
+    double mFps;
+
+    // Processing parameters, copied from urbi variables on the urbi side as
+    // detect() runs on other threads, mProcessMutex held
+    double mScale;
+    bool mTracking;
+    int mDetectInterval;
+    int mThreads;
+
+    // Urbi variables are set only on the urbi side, frames processed by
+    // other threads are published by update()
+    static const int PUBLISH_PERIOD_MS = 10;
+    boost::atomic<bool> mResultsPending; // processed frame not published yet
+    boost::uint64_t mPublishedCounts; // sum of mailbox counters last published
     
     // Urbi functions
     void changeNotifyImage(UVar&); // change mode function
     void changeHaarCascade();
     void changeScale(UVar&);
+    void changeParameters(); // copies processing parameters for detect()
+    void changeInputPolicy();
+    void changeDispatcher();
     void detectFrom(UImage); // image processing function
+    void detectFromShm(UVar&); // image processing of shared memory frame
     void SetImage(UImage);
+    void publish(); // results of mDetector to urbi variables
+    void publishStages(); // stage timing to urbi variables
+    void changeTrace(UVar&);
+    void dumpTrace(string); // writes Chrome trace JSON of all detectors
+    UList processVideo(string path); // results of every frame of a video or recording
+    UList processBatch(UList files); // results of every image file
+    UList processFrames(BatchReader& reader);
+    void processThreadFunction(); // processes frames from mMailbox
+    void processFrame(const FrameMailbox::Frame&); // called by both threads
+    void detect(const FrameMailbox::Frame&); // mProcessMutex held
+    void publishResults(); // results of the last frame, mProcessMutex held
+    void publishCounters();
     
     // Urbi variables
     // Results
@@ -48,7 +93,27 @@ private:
     UVar y; // position of the object center
     UVar fps; // fps processing
     UVar image; //image after processing
+    UVar received; // frames received from the source
+    UVar processed; // frames processed
+    UVar dropped; // frames dropped by the input policy
+    UVar allocations; // image buffers allocated so far, grows only when size changes
+    UVar trace; // measure processing stages
+    UVar stages; // [stage, average ms] pairs, updated while tracing
+    UVar tracking; // follow objects between cascade runs
+    UVar detectInterval; // tracked frames between cascade runs
+    UVar redetectionRate; // average part of frames running the cascade
+    UVar frameTime; // average processing time of a frame in ms
+    UVar confidence; // part of the points that followed the objects
+    UVar threads; // threads running the cascade, 0 - one per core
     UVar *mInputImage;
+    UVar *mDescriptor;
+    ShmFrameInput mShmInput;
+    ScratchPool mInputPool; // copies of input frames waiting in mMailbox
+    FrameMailbox mMailbox; // frames waiting for processing
+    boost::thread mProcessThread;
+    boost::mutex mProcessMutex; // mDetector is used by one thread at a time
+    string mDispatcher; // registered with this dispatcher
+    boost::mutex mBatchMutex; // one batch at a time
     UBinary mBinImage;
     // Parameters
     UVar scale; // image scale
@@ -57,19 +122,30 @@ private:
     UVar height; // image height
     UVar notifyImage; // process new images;
     UVar mode;
+    UVar inputPolicy; // 0 - newest frame only, 1 - queue of queueSize frames, 2 - source waits
+    UVar queueSize;
+    UVar dispatcher; // name of UDispatcher feeding frames, empty - own input
 };
 
-UObjectDetector::UObjectDetector(const string& s) : UObject(s) {
+UObjectDetector::UObjectDetector(const string& s) : UObject(s), mInputImage(0), mDescriptor(0) {
     UBindFunction(UObjectDetector, init);
 }
 
 UObjectDetector::~UObjectDetector() {
+    if (!mDispatcher.empty())
+        FrameDispatcher::get(mDispatcher).remove(__name);
+    mMailbox.close();
+    mProcessThread.interrupt();
+    mProcessThread.join();
+
     // Prevent of double free error
-    if(mBinImage.image.data == mResultImage.data)
+    if(mBinImage.image.data == mDetector.result().data)
         mBinImage.image.data = 0;
     
     if(mInputImage)
         delete mInputImage;
+    if(mDescriptor)
+        delete mDescriptor;
 }
 
 int UObjectDetector::init(UVar& sourceImage) {
@@ -87,10 +163,18 @@ int UObjectDetector::init(UVar& sourceImage) {
             height,
             notifyImage,
             mode);
+    UBindVars(UObjectDetector, inputPolicy, queueSize, dispatcher, received, processed, dropped);
+    UBindVars(UObjectDetector, allocations, trace, stages);
+    UBindVars(UObjectDetector, tracking, detectInterval, redetectionRate, frameTime, confidence);
+    UBindVars(UObjectDetector, threads);
     
     // Bind functions
     UBindThreadedFunction(UObjectDetector, detectFrom, LOCK_INSTANCE);
     UBindThreadedFunction(UObjectDetector, SetImage, LOCK_INSTANCE);
+    UBindFunction(UObjectDetector, attach);
+    UBindFunction(UObjectDetector, dumpTrace);
+    UBindThreadedFunction(UObjectDetector, processVideo, LOCK_FUNCTION);
+    UBindThreadedFunction(UObjectDetector, processBatch, LOCK_FUNCTION);
     
     mBinImage.type = BINARY_IMAGE;
     mBinImage.image.imageFormat = IMAGE_RGB;
@@ -102,6 +186,26 @@ int UObjectDetector::init(UVar& sourceImage) {
     scale = 1;
     height = -1;
     width = -1;
+    inputPolicy = MAILBOX_COALESCE;
+    queueSize = 2;
+    dispatcher = "";
+    received = 0;
+    processed = 0;
+    dropped = 0;
+    allocations = 0;
+    trace = 0;
+    stages = UList();
+    tracking = 0;
+    detectInterval = mDetector.detectInterval();
+    redetectionRate = 1;
+    frameTime = 0;
+    confidence = 0;
+    threads = 1;
+    mDetector.times().setOwner(__name);
+    mLastTick = getTickCount();
+    mFps = 0;
+    mResultsPending = false;
+    mPublishedCounts = 0;
     
     mInputImage = new UVar(sourceImage);
     UNotifyChange(*mInputImage, &UObjectDetector::detectFrom);
@@ -109,6 +213,30 @@ int UObjectDetector::init(UVar& sourceImage) {
     UNotifyChange(mode, &UObjectDetector::changeNotifyImage);
     UNotifyChange(cascade, &UObjectDetector::changeHaarCascade);
     UNotifyChange(scale, &UObjectDetector::changeScale);
+    UNotifyChange(inputPolicy, &UObjectDetector::changeInputPolicy);
+    UNotifyChange(queueSize, &UObjectDetector::changeInputPolicy);
+    UNotifyChange(dispatcher, &UObjectDetector::changeDispatcher);
+    UNotifyChange(trace, &UObjectDetector::changeTrace);
+    UNotifyChange(scale, &UObjectDetector::changeParameters);
+    UNotifyChange(tracking, &UObjectDetector::changeParameters);
+    UNotifyChange(detectInterval, &UObjectDetector::changeParameters);
+    UNotifyChange(threads, &UObjectDetector::changeParameters);
+    changeParameters();
+    USetUpdate(PUBLISH_PERIOD_MS);
+    
+    // Start processing thread
+    mProcessThread = boost::thread(&UObjectDetector::processThreadFunction, this);
+    
+    return 0;
+}
+
+int UObjectDetector::attach(UVar& descriptor) {
+    // Frames come from shared memory instead of the image variable
+    mInputImage->unnotify();
+    if(mDescriptor)
+        delete mDescriptor;
+    mDescriptor = new UVar(descriptor);
+    UNotifyChange(*mDescriptor, &UObjectDetector::detectFromShm);
     
     return 0;
 }
@@ -116,12 +244,19 @@ int UObjectDetector::init(UVar& sourceImage) {
 void UObjectDetector::changeNotifyImage(UVar& var) {
     // Always unnotify
     mInputImage->unnotify();
-    if (var.as<bool>())
-        UNotifyChange(*mInputImage, &UObjectDetector::detectFrom);
+    if (mDescriptor)
+        mDescriptor->unnotify();
+    if (var.as<bool>() && mDispatcher.empty()) {
+        if (mDescriptor)
+            UNotifyChange(*mDescriptor, &UObjectDetector::detectFromShm);
+        else
+            UNotifyChange(*mInputImage, &UObjectDetector::detectFrom);
+    }
 }
 
 void UObjectDetector::changeHaarCascade() {
-    if(!mCVCascade.load(cascade))
+    boost::lock_guard<boost::mutex> lock(mProcessMutex);
+    if(!mDetector.load(cascade))
         throw std::runtime_error("Could not load cascade classifier");
     
     cerr << "New " << cascade.as<string>() << " loaded." << endl;
@@ -134,128 +269,241 @@ void UObjectDetector::changeScale(UVar& newScale) {
     scale = tmp;
 }
 
+void UObjectDetector::changeParameters() {
+    boost::lock_guard<boost::mutex> lock(mProcessMutex);
+    mScale = scale.as<double>() > 1.0 ? scale.as<double>() : 1.0;
+    mTracking = tracking.as<bool>();
+    mDetectInterval = detectInterval.as<int>();
+    mThreads = threads.as<int>() > 0 ? threads.as<int>() : 0;
+}
+
+void UObjectDetector::changeInputPolicy() {
+    mMailbox.setPolicy(inputPolicy.as<int>(), queueSize.as<int>() > 0 ? queueSize.as<int>() : 1);
+}
+
 void UObjectDetector::detectFrom(UImage src) {
-    // Build MatImage with data from uImage
-    Mat processImage(Size(src.width, src.height), CV_8UC3, src.data);
-    
-    // Resize image
-    Mat smallImage(cvRound(processImage.rows/scale.as<double>()), cvRound(processImage.cols/scale.as<double>()), CV_8UC1);
-    resize(processImage, mResultImage, smallImage.size(), 0, 0, INTER_LINEAR);
-    width = mResultImage.cols;
-    height = mResultImage.rows;
-    
-    cvtColor(mResultImage, smallImage, CV_RGB2GRAY);
-    equalizeHist(smallImage, smallImage);
-    
-    if(mCVCascade.empty()) {
-        throw std::runtime_error("Cascade classifier not loaded");
-    } else {
-        // ...to measure all processing time
-        int64 startTick = getTickCount();
-        fps = static_cast<double>(getTickFrequency()) / (startTick - mLastTick);
-        mLastTick = startTick;
-        
-        vector<Rect> objects;
-        mCVCascade.detectMultiScale(smallImage, objects, 1.1, 2, 0 | CV_HAAR_SCALE_IMAGE, Size(30, 30));
-        
-        if(!objects.empty()) {
-            //TODO wykorzystać boost??
-            vector<Rect>::const_iterator biggest = objects.begin();
-            for(vector<Rect>::const_iterator i = objects.begin(); i < objects.end(); ++i) {
-                if(i->area() > biggest->area())
-                    biggest = i;
+    // Copy data from uImage, the frame is processed later by the processing
+    // thread and the source reuses its buffer. Grayscale images are taken
+    // as is.
+    int type = src.imageFormat == IMAGE_GREY8 ? CV_8UC1 : CV_8UC3;
+    FrameMailbox::Frame frame;
+    frame.image = mInputPool.take(Size(src.width, src.height), type);
+    Mat(Size(src.width, src.height), type, src.data).copyTo(frame.image);
+    frame.source = mInputImage->get_name();
+    mMailbox.post(frame);
+}
+
+void UObjectDetector::detectFromShm(UVar& descriptor) {
+    // Frame is processed in place, pinned until it is processed or dropped
+    UList list = descriptor.as<UList>();
+    boost::shared_ptr<ShmFrameView> view = mShmInput.acquire(list);
+    if (!view)
+        return;
+    FrameMailbox::Frame frame;
+    frame.image = view->image;
+    frame.source = static_cast<string>(list[0]);
+    frame.id = view->seq;
+    frame.owner = view;
+    mMailbox.post(frame);
+}
+
+void UObjectDetector::processThreadFunction() {
+    try {
+        while (true) {
+            FrameMailbox::Frame frame;
+            mMailbox.take(frame);
+            try {
+                processFrame(frame);
+            } catch (std::exception& e) {
+                cerr << "UObjectDetector::process(): " << e.what() << endl;
             }
-            
-            // Draw on a mResultImage
-            Point center(biggest->x+biggest->width/2, biggest->y+biggest->height/2);
-            int radius = (biggest->height + biggest->height)/4;
-            circle(mResultImage, center, radius, Scalar(255,0,0), 3, 8, 0);
-            line(mResultImage, center, Point(mResultImage.cols/2, mResultImage.rows/2), Scalar(255, 0, 0), 2);
-            
-            // Set position of the object
-            x = biggest->x-mResultImage.cols/2;
-            y = -biggest->y-mResultImage.rows/2;
-            
-            visible = 1;
-        } else {
-            visible = 0;
-            x = 0;
-            y = 0;
+            mMailbox.done();
         }
+    } catch (boost::thread_interrupted&) {
+        return;
     }
+}
+
+void UObjectDetector::processFrame(const FrameMailbox::Frame& frame) {
+    // Runs on the processing or dispatcher thread, results are published
+    // by update()
+    boost::lock_guard<boost::mutex> lock(mProcessMutex);
+    detect(frame);
+    mResultsPending = true;
+}
+
+void UObjectDetector::detect(const FrameMailbox::Frame& frame) {
+    mDetector.setScale(mScale);
+    mDetector.setTracking(mTracking, mDetectInterval);
+    mDetector.setThreads(mThreads);
+    mDetector.process(frame.image, frame.source, frame.id);
+
+    // ...to measure all processing time
+    int64 tick = getTickCount();
+    mFps = static_cast<double>(getTickFrequency()) / (tick - mLastTick);
+    mLastTick = tick;
+}
+
+int UObjectDetector::update() {
+    publishCounters();
+    // A frame being processed is published in one of the next periods,
+    // urbi does not wait for the processing thread
+    if (!mResultsPending)
+        return 0;
+    boost::unique_lock<boost::mutex> lock(mProcessMutex, boost::try_to_lock);
+    if (lock.owns_lock())
+        publishResults();
+    return 0;
+}
+
+void UObjectDetector::publishResults() {
+    mResultsPending = false;
+    {
+        ScopedStage stage(mDetector.times(), STAGE_PUBLISH);
+        publish();
+    }
+    if (mDetector.times().enabled())
+        publishStages();
+}
+
+void UObjectDetector::publishCounters() {
+    boost::uint64_t counts = mMailbox.received() + mMailbox.processed() + mMailbox.dropped();
+    if (counts == mPublishedCounts)
+        return;
+    mPublishedCounts = counts;
+    received = static_cast<double>(mMailbox.received());
+    processed = static_cast<double>(mMailbox.processed());
+    dropped = static_cast<double>(mMailbox.dropped());
+}
+
+void UObjectDetector::changeDispatcher() {
+    if (!mDispatcher.empty())
+        FrameDispatcher::get(mDispatcher).remove(__name);
+    mDispatcher = dispatcher.as<string>();
     
-    // Draw horizontal and vertical line in the middle of the image
-    line(mResultImage, Point(0, mResultImage.rows/2), Point(mResultImage.cols, mResultImage.rows/2), Scalar(100, 100, 100), 1);
-    line(mResultImage, Point(mResultImage.cols/2, 0), Point(mResultImage.cols/2, mResultImage.rows), Scalar(100, 100, 100), 1);
-    
-    // Copy mResult image to UImage
-    mBinImage.image.width = mResultImage.cols;
-    mBinImage.image.height = mResultImage.rows;
-    mBinImage.image.size = mResultImage.cols * mResultImage.rows * 3;
-    mBinImage.image.data = mResultImage.data;
-    image = mBinImage;
+    // Frames come either from the dispatcher or from own input
+    mInputImage->unnotify();
+    if (mDescriptor)
+        mDescriptor->unnotify();
+    if (!mDispatcher.empty())
+        FrameDispatcher::get(mDispatcher).add(__name, boost::bind(&UObjectDetector::processFrame, this, _1));
+    else if (mDescriptor)
+        UNotifyChange(*mDescriptor, &UObjectDetector::detectFromShm);
+    else
+        UNotifyChange(*mInputImage, &UObjectDetector::detectFrom);
 }
 
-void UObjectDetector::SetImage(UImage src) {
-    // Build MatImage with data from uImage
-    Mat processImage(Size(src.width, src.height), CV_8UC3, src.data);
+void UObjectDetector::publish() {
+    const Mat& resultImage = mDetector.result();
+    width = resultImage.cols;
+    height = resultImage.rows;
     
-    // Resize image
-    Mat smallImage(cvRound(processImage.rows/scale.as<double>()), cvRound(processImage.cols/scale.as<double>()), CV_8UC1);
-    resize(processImage, mResultImage, smallImage.size(), 0, 0, INTER_LINEAR);
-    width = mResultImage.cols;
-    height = mResultImage.rows;
+    fps = mFps;
     
-    cvtColor(mResultImage, smallImage, CV_RGB2GRAY);
-    equalizeHist(smallImage, smallImage);
+    // Set position of the object
+    number = static_cast<int>(mDetector.objects().size());
+    x = mDetector.position().x;
+    y = mDetector.position().y;
+    visible = mDetector.visible() ? 1 : 0;
+    redetectionRate = mDetector.redetectionRate();
+    frameTime = mDetector.frameTime();
+    confidence = mDetector.confidence();
     
-    if(mCVCascade.empty()) {
-        throw std::runtime_error("Cascade classifier not loaded");
-    } else {
-        // ...to measure all processing time
-        int64 startTick = getTickCount();
-        fps = static_cast<double>(getTickFrequency()) / (startTick - mLastTick);
-        mLastTick = startTick;
-        
-        vector<Rect> objects;
-        mCVCascade.detectMultiScale(smallImage, objects, 1.1, 2, 0 | CV_HAAR_SCALE_IMAGE, Size(30, 30));
-        
-        if(!objects.empty()) {
-            //TODO wykorzystać boost??
-            vector<Rect>::const_iterator biggest = objects.begin();
-            for(vector<Rect>::const_iterator i = objects.begin(); i < objects.end(); ++i) {
-                if(i->area() > biggest->area())
-                    biggest = i;
-            }
-            
-            // Draw on a mResultImage
-            Point center(biggest->x+biggest->width/2, biggest->y+biggest->height/2);
-            int radius = (biggest->height + biggest->height)/4;
-            circle(mResultImage, center, radius, Scalar(255,0,0), 3, 8, 0);
-            line(mResultImage, center, Point(mResultImage.cols/2, mResultImage.rows/2), Scalar(255, 0, 0), 2);
-            
-            // Set position of the object
-            x = biggest->x-mResultImage.cols/2;
-            y = -biggest->y-mResultImage.rows/2;
-            
-            visible = 1;
-        } else {
-            visible = 0;
-            x = 0;
-            y = 0;
+    // Copy result image to UImage
+    mBinImage.image.width = resultImage.cols;
+    mBinImage.image.height = resultImage.rows;
+    mBinImage.image.size = resultImage.cols * resultImage.rows * 3;
+    mBinImage.image.data = resultImage.data;
+    image = mBinImage;
+
+    allocations = static_cast<double>(mInputPool.allocations());
+}
+
+void UObjectDetector::publishStages() {
+    // Rolling averages of the measured stages
+    UList list;
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        if (mDetector.times().average(i) > 0) {
+            UList item;
+            item.push_back(string(stageName(i)));
+            item.push_back(mDetector.times().average(i));
+            list.push_back(item);
         }
     }
-    
-    // Draw horizontal and vertical line in the middle of the image
-    line(mResultImage, Point(0, mResultImage.rows/2), Point(mResultImage.cols, mResultImage.rows/2), Scalar(100, 100, 100), 1);
-    line(mResultImage, Point(mResultImage.cols/2, 0), Point(mResultImage.cols/2, mResultImage.rows), Scalar(100, 100, 100), 1);
-    
-    // Copy mResult image to UImage
-    mBinImage.image.width = mResultImage.cols;
-    mBinImage.image.height = mResultImage.rows;
-    mBinImage.image.size = mResultImage.cols * mResultImage.rows * 3;
-    mBinImage.image.data = mResultImage.data;
-    image = mBinImage;
+    stages = list;
+}
+
+void UObjectDetector::changeTrace(UVar& var) {
+    mDetector.times().enable(var.as<bool>());
+}
+
+void UObjectDetector::dumpTrace(string file) {
+    ofstream out(file.c_str());
+    writeStageTrace(out);
+    if (!out)
+        throw std::runtime_error("Could not write trace " + file);
+}
+
+UList UObjectDetector::processVideo(string path) {
+    BatchReader reader(path);
+    return processFrames(reader);
+}
+
+UList UObjectDetector::processBatch(UList files) {
+    vector<string> paths;
+    for (size_t i = 0; i < files.size(); ++i)
+        paths.push_back(static_cast<string>(files[i]));
+    BatchReader reader(paths);
+    return processFrames(reader);
+}
+
+UList UObjectDetector::processFrames(BatchReader& reader) {
+    boost::lock_guard<boost::mutex> batchLock(mBatchMutex);
+
+    // Own detector with the current parameters, so live frames keep being
+    // processed meanwhile
+    ObjectDetector detector;
+    detector.setThreads(threads.as<int>() > 0 ? threads.as<int>() : 0);
+    if (!detector.load(cascade))
+        throw std::runtime_error("Could not load cascade classifier");
+    detector.setScale(scale.as<double>());
+    detector.setTracking(tracking.as<bool>(), detectInterval.as<int>());
+    detector.times().setOwner(__name + ".batch");
+    detector.times().enable(trace.as<bool>());
+
+    // Frames are decoded on another thread while this one detects
+    UList visibleList, xList, yList, numberList;
+    Mat frame;
+    double timestamp;
+    boost::uint64_t id = 0;
+    while (reader.next(frame, timestamp)) {
+        detector.process(frame, __name + ".batch", ++id);
+        visibleList.push_back(detector.visible() ? 1 : 0);
+        xList.push_back(detector.position().x);
+        yList.push_back(detector.position().y);
+        numberList.push_back(static_cast<int>(detector.objects().size()));
+    }
+
+    // [visible, x, y, number], one element per frame in each
+    UList result;
+    result.push_back(visibleList);
+    result.push_back(xList);
+    result.push_back(yList);
+    result.push_back(numberList);
+    return result;
+}
+
+void UObjectDetector::SetImage(UImage src) {
+    // Processed right away, results are set when SetImage returns
+    int type = src.imageFormat == IMAGE_GREY8 ? CV_8UC1 : CV_8UC3;
+    FrameMailbox::Frame frame;
+    frame.image = mInputPool.take(Size(src.width, src.height), type);
+    Mat(Size(src.width, src.height), type, src.data).copyTo(frame.image);
+    frame.source = mInputImage->get_name();
+
+    boost::lock_guard<boost::mutex> lock(mProcessMutex);
+    detect(frame);
+    publishResults();
 }
 
 UStart(UObjectDetector);
@@ -0,0 +1,62 @@
+/*******************************************
+ *
+ *	WorkerPool
+ *   Fixed number of threads executing posted jobs.
+ *
+ ********************************************/
+
+#include "workerpool.h"
+
+#include <boost/bind.hpp>
+
+#include <exception>
+#include <iostream>
+
+using namespace boost;
+using namespace std;
+
+WorkerPool::WorkerPool(size_t threads) :
+        mSize(threads > 0 ? threads : 1), mStopping(false) {
+    for (size_t i = 0; i < mSize; ++i)
+        mThreads.create_thread(boost::bind(&WorkerPool::workerFunction, this));
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStopping = true;
+        mJobs.clear();
+    }
+    mCond.notify_all();
+    mThreads.join_all();
+}
+
+void WorkerPool::post(const boost::function<void()>& job) {
+    {
+        lock_guard<mutex> lock(mMutex);
+        mJobs.push_back(job);
+    }
+    mCond.notify_one();
+}
+
+void WorkerPool::workerFunction() {
+    while (true) {
+        boost::function<void()> job;
+        {
+            unique_lock<mutex> lock(mMutex);
+            while (!mStopping && mJobs.empty())
+                mCond.wait(lock);
+            if (mStopping)
+                return;
+            job = mJobs.front();
+            mJobs.pop_front();
+        }
+
+        try {
+            job();
+        } catch (std::exception& e) {
+            cerr << "WorkerPool::workerFunction()" << endl
+                    << "\tJob failed: " << e.what() << endl;
+        }
+    }
+}
@@ -0,0 +1,39 @@
+/*******************************************
+ *
+ *	WorkerPool
+ *   Fixed number of threads executing posted jobs in
+ *   order of arrival.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_WORKERPOOL_H
+#define URBICAMERA_WORKERPOOL_H
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
+
+class WorkerPool : boost::noncopyable {
+public:
+    explicit WorkerPool(size_t threads);
+    // Jobs not started yet are dropped, running ones are waited for
+    ~WorkerPool();
+
+    size_t size() const { return mSize; }
+
+    void post(const boost::function<void()>& job);
+
+private:
+    void workerFunction();
+
+    size_t mSize;
+    bool mStopping;
+    std::deque<boost::function<void()> > mJobs;
+    boost::mutex mMutex;
+    boost::condition_variable mCond;
+    boost::thread_group mThreads;
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*******************************************
+ *
+ *	WorkStealingPool
+ *   Fixed number of threads, each with its own job queue.
+ *
+ ********************************************/
+
+#include "workstealingpool.h"
+
+#include <boost/bind.hpp>
+
+#include <exception>
+#include <iostream>
+
+using namespace boost;
+using namespace std;
+
+WorkStealingPool::WorkStealingPool(size_t threads) :
+        mNext(0), mPending(0), mStopping(false) {
+    if (threads == 0)
+        threads = boost::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+
+    for (size_t i = 0; i < threads; ++i)
+        mWorkers.push_back(new Worker);
+    for (size_t i = 0; i < threads; ++i)
+        mThreads.create_thread(boost::bind(&WorkStealingPool::workerFunction, this, i));
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mCond.notify_all();
+    mThreads.join_all();
+}
+
+void WorkStealingPool::post(const boost::function<void()>& job) {
+    // Counted before it is queued, so mPending never goes below zero
+    ++mPending;
+    Worker& worker = mWorkers[mNext++ % mWorkers.size()];
+    {
+        lock_guard<mutex> lock(worker.mutex);
+        worker.jobs.push_back(job);
+    }
+    // Sleeping threads check mPending under mMutex, so the wakeup is not lost
+    lock_guard<mutex> lock(mMutex);
+    mCond.notify_one();
+}
+
+bool WorkStealingPool::pop(size_t self, boost::function<void()>& job) {
+    for (size_t k = 0; k < mWorkers.size(); ++k) {
+        Worker& worker = mWorkers[(self + k) % mWorkers.size()];
+        lock_guard<mutex> lock(worker.mutex);
+        if (worker.jobs.empty())
+            continue;
+        // Owner takes the oldest job, thieves the newest one
+        if (k == 0) {
+            job = worker.jobs.front();
+            worker.jobs.pop_front();
+        } else {
+            job = worker.jobs.back();
+            worker.jobs.pop_back();
+        }
+        --mPending;
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::workerFunction(size_t self) {
+    while (true) {
+        boost::function<void()> job;
+        if (!pop(self, job)) {
+            unique_lock<mutex> lock(mMutex);
+            while (!mStopping && mPending == 0)
+                mCond.wait(lock);
+            if (mStopping)
+                return;
+            continue;
+        }
+
+        try {
+            job();
+        } catch (std::exception& e) {
+            cerr << "WorkStealingPool::workerFunction()" << endl
+                    << "\tJob failed: " << e.what() << endl;
+        }
+    }
+}
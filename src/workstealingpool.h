@@ -0,0 +1,54 @@
+/*******************************************
+ *
+ *	WorkStealingPool
+ *   Fixed number of threads, each with its own job queue.
+ *   Jobs are spread over the queues and a thread that runs
+ *   out of work takes jobs from the back of the others, so
+ *   uneven jobs still keep all cores busy.
+ *
+ ********************************************/
+
+#ifndef URBICAMERA_WORKSTEALINGPOOL_H
+#define URBICAMERA_WORKSTEALINGPOOL_H
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
+
+class WorkStealingPool : boost::noncopyable {
+public:
+    // threads = 0 - one thread per core
+    explicit WorkStealingPool(size_t threads = 0);
+    // Jobs not started yet are dropped, running ones are waited for
+    ~WorkStealingPool();
+
+    size_t size() const { return mWorkers.size(); }
+
+    void post(const boost::function<void()>& job);
+
+private:
+    struct Worker {
+        boost::mutex mutex;
+        std::deque<boost::function<void()> > jobs;
+    };
+
+    void workerFunction(size_t);
+    // Own queue first, then steal from the others
+    bool pop(size_t, boost::function<void()>&);
+
+    boost::ptr_vector<Worker> mWorkers;
+    boost::atomic<size_t> mNext; // queue of the next posted job
+    boost::atomic<size_t> mPending; // jobs in all queues
+
+    // Idle threads sleep here
+    boost::mutex mMutex;
+    boost::condition_variable mCond;
+    bool mStopping;
+    boost::thread_group mThreads;
+};
+
+#endif